@@ -2,36 +2,260 @@
 #include "src/GLFWGeneral.h"
 #include "src/arguments.hpp"
 #include "src/renderer.hpp"
+#include "src/timeline.hpp"
+#include "src/scene_pack.hpp"
+#include "src/paged_scene.hpp"
+#include "src/foam_lod.hpp"
+#include "src/sh_codebook.hpp"
+#include "src/scene_manager.hpp"
+#include "src/quality_tier.hpp"
+#include <future>
 
+// Loads a fully resident scene with every GPU transform the arguments ask for. The startup
+// reports run on the first scene only, so only it keeps the data they compare against. reserve,
+// when set, gets the projected device memory of the scene before any of its buffers exists.
+static SceneManager::Scene loadResidentScene(std::shared_ptr<RadFoamVulkanArgs> pArgs, Timeline &timeline,
+                                             const std::string &label, bool reports,
+                                             const SceneManager::Reserve &reserve = nullptr)
+{
+    std::shared_ptr<RadFoam> pModel;
+    std::shared_ptr<AABBTree> pAABB;
+    std::shared_ptr<FoamLod> pLod;
+    std::shared_ptr<ShCodebook> pCodebook;
+    // The quality tier is projected from the header counts, so the scene is loaded in its SH format
+    bool facePlanes = pArgs->facePlanes;
+    RadFoam::ShFormatChooser chooseShFormat;
+    if (pArgs->autoQuality || reserve)
+        chooseShFormat = [&](size_t numCells, size_t numAdjacency, uint32_t shDegree)
+        {
+            QualityTier::Counts counts{numCells, numAdjacency, shDegree, 0, 0};
+            if (pArgs->lodScale > 0)
+                std::tie(counts.numCoarseCells, counts.numCoarseAdjacency) =
+                    FoamLod::projectCoarseCounts(*pArgs, numCells, numAdjacency);
+            // Without --autoQuality the SH are loaded as float32 and converted afterwards
+            RadFoam::ShFormat format{shDegree, false};
+            size_t footprint;
+            if (pArgs->autoQuality)
+            {
+                auto scope = timeline.scope("Choose quality tier" + label);
+                auto choice = QualityTier::choose(counts);
+                facePlanes = choice.facePlanes;
+                format = {choice.shDegree, choice.halfSh};
+                footprint = choice.footprint;
+            }
+            else
+                footprint = QualityTier::project(counts, pArgs->halfSh, shDegree,
+                                                 facePlanes || pArgs->sharedFaces).footprint;
+            if (reserve)
+                reserve(footprint);
+            return format;
+        };
+    {
+        auto scope = timeline.scope("Load scene" + label);
+        pModel = std::make_shared<RadFoam>(pArgs, chooseShFormat);
+    }
+    {
+        auto scope = timeline.scope("Build AABB tree" + label);
+        pAABB = std::make_shared<AABBTree>(pModel);
+    }
+    // A PLY load refreshes the cache so that the next launch skips parsing and tree building.
+    // The cache holds the source SH, which a scene loaded in a leaner format no longer has.
+    if (!pModel->getCache() && !ScenePack::isPackPath(pArgs->scenePath) && pModel->hasSourceSh())
+    {
+        auto scope = timeline.scope("Write scene cache" + label);
+        SceneCache::save(*pArgs, *pModel, *pAABB);
+    }
+    pModel->releaseCache();
+    if (!pArgs->packPath.empty())
+    {
+        auto scope = timeline.scope("Write scene pack" + label);
+        ScenePack::write(pArgs->packPath, *pModel);
+    }
+    // Coarse cells are appended to the scene buffers, so this comes after the cache and pack
+    if (pArgs->lodScale > 0)
+    {
+        auto scope = timeline.scope("Load LOD hierarchy" + label);
+        pLod = std::make_shared<FoamLod>(*pArgs, *pModel);
+        pLod->attach(*pModel);
+    }
+    // After the LOD so that its coarse cells are compressed too; the codebook takes precedence
+    if (pArgs->shCodebook > 0)
+    {
+        auto scope = timeline.scope("Load SH codebook" + label);
+        pCodebook = std::make_shared<ShCodebook>(*pArgs, *pModel, pArgs->shCodebook);
+        pCodebook->attach(*pModel, reports && pArgs->shReport);
+    }
+    else if (pArgs->halfSh)
+    {
+        auto scope = timeline.scope("Convert SH to float16" + label);
+        pModel->convertShToHalf(reports && pArgs->shReport);
+    }
+    // Its PSNR is always reported, so the float32 SH stay until then
+    else if (pArgs->variableSh)
+    {
+        auto scope = timeline.scope("Pack variable-length SH" + label);
+        pModel->packVariableSh(pArgs->shBandEnergy, pArgs->shMinDensity, reports);
+    }
+    // Planes are computed from float32 positions and follow the CSR adjacency
+    if (pArgs->sharedFaces)
+    {
+        auto scope = timeline.scope("Build shared faces" + label);
+        pModel->buildSharedFaces(facePlanes);
+    }
+    else if (facePlanes)
+    {
+        auto scope = timeline.scope("Build face planes" + label);
+        pModel->buildFacePlanes();
+    }
+    else if (pArgs->paddedAdjacency)
+    {
+        auto scope = timeline.scope("Build padded adjacency" + label);
+        pModel->buildPaddedAdjacency(reports && pArgs->paddedAdjacencyReport);
+    }
+    // Planes are indexed by adjacency entry, which the delta encoding keeps
+    if (pArgs->deltaAdjacency)
+    {
+        auto scope = timeline.scope("Encode delta adjacency" + label);
+        pModel->buildDeltaAdjacency();
+    }
+    if (pArgs->positionBits > 0)
+    {
+        auto scope = timeline.scope("Quantize positions" + label);
+        pModel->quantizePositionBuffer(pArgs->positionBits, reports && pArgs->positionReport);
+    }
+    if (pArgs->lowMemory)
+    {
+        auto scope = timeline.scope("Release host scene data" + label);
+        size_t before = getCurrentResidentMemory();
+        size_t hostBefore = pModel->getHostDataSize() + pAABB->getHostDataSize();
+        pAABB->releaseHostData();
+        pModel->compactHostData(pArgs->quantizePositions);
+        std::cout << std::format("Low-memory mode: host scene data {}MB -> {}MB, resident memory {}MB -> {}MB\n",
+                                 hostBefore >> 20, pModel->getHostDataSize() >> 20,
+                                 before >> 20, getCurrentResidentMemory() >> 20);
+    }
+    return {pModel, pAABB, pLod, pCodebook};
+}
 
 int main(int argc, char *argv[])
 {
     auto args = argparse::parse<RadFoamVulkanArgs>(argc, argv);
     auto pArgs = std::make_shared<RadFoamVulkanArgs>(args);
+    Timeline timeline;
+
+    // Scenes the number keys switch between; the others take every argument but the path too
+    std::vector<std::string> scenePaths{pArgs->scenePath};
+    for (size_t begin = 0; begin < pArgs->extraScenes.size();)
+    {
+        size_t end = std::min(pArgs->extraScenes.find(',', begin), pArgs->extraScenes.size());
+        if (end > begin)
+            scenePaths.push_back(pArgs->extraScenes.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    if (scenePaths.size() > 1)
+    {
+        if (pArgs->pageBudget > 0 || !pArgs->cachePath.empty() || !pArgs->packPath.empty())
+            throw std::runtime_error("--pageBudget, --cache and --writePack cannot be combined with --scenes");
+        if (scenePaths.size() > 9)
+            throw std::runtime_error("--scenes takes at most 8 scenes, one per number key");
+    }
+    if (pArgs->shCodebook > ShCodebook::maxEntries)
+        throw std::runtime_error(std::format("--shCodebook takes at most {} entries", ShCodebook::maxEntries));
+    if (pArgs->paddedAdjacency && (pArgs->facePlanes || pArgs->sharedFaces))
+        throw std::runtime_error("--paddedAdjacency replaces the CSR adjacency that --facePlanes and --sharedFaces "
+                                 "follow and cannot be combined with them");
+    if (pArgs->variableSh && (pArgs->halfSh || pArgs->shCodebook > 0))
+        throw std::runtime_error("--variableSh packs float32 SH and cannot be combined with --halfSh or --shCodebook");
+    if (pArgs->autoQuality && (pArgs->halfSh || pArgs->shCodebook > 0 || pArgs->variableSh || pArgs->facePlanes ||
+                               pArgs->sharedFaces || pArgs->paddedAdjacency || pArgs->shReport ||
+                               pArgs->facePlaneReport || !pArgs->packPath.empty()))
+        throw std::runtime_error("--autoQuality chooses the SH and face plane options itself and cannot be combined "
+                                 "with --halfSh, --shCodebook, --variableSh, --facePlanes, --sharedFaces, "
+                                 "--paddedAdjacency or their reports, nor with --writePack");
 
-    initializeWindow(pArgs);
-    auto pModel = std::make_shared<RadFoam>(pArgs);
-    auto pAABB = std::make_shared<AABBTree>(pModel);
+    // Scene parsing starts right away; its first Vulkan call waits for the device below
+    auto sceneLoad = std::async(std::launch::async, [&]()
+                                {
+        std::shared_ptr<PagedScene> pPagedScene;
+        SceneManager::Scene scene;
+        if (pArgs->pageBudget > 0)
+        {
+            // Both work on the whole resident scene
+            if (pArgs->shCodebook > 0 || pArgs->variableSh || pArgs->positionBits > 0 || pArgs->facePlanes ||
+                pArgs->sharedFaces || pArgs->paddedAdjacency || pArgs->deltaAdjacency || pArgs->autoQuality)
+                throw std::runtime_error("--shCodebook, --variableSh, --positionBits, --facePlanes, --sharedFaces, "
+                                         "--paddedAdjacency, --deltaAdjacency and --autoQuality cannot be combined "
+                                         "with --pageBudget");
+            auto scope = timeline.scope("Scan paged scene");
+            pPagedScene = std::make_shared<PagedScene>(pArgs->scenePath, size_t(pArgs->pageBudget) << 20, pArgs->halfSh);
+            return std::make_pair(pPagedScene, scene);
+        }
+        scene = loadResidentScene(pArgs, timeline, "", true);
+        return std::make_pair(pPagedScene, scene); });
 
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].min[0] << std::endl;
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].min[1] << std::endl;
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].min[2] << std::endl;
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].max[0] << std::endl;
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].max[1] << std::endl;
-    // std::cout << pAABB->aabbTree[(1 << pAABB->numLevels) - 2].max[2] << std::endl;
+    // GLFW must stay on the main thread
+    {
+        auto scope = timeline.scope("Create window and device");
+        initializeWindow(pArgs);
+    }
+    std::shared_ptr<Renderer> renderer;
+    {
+        auto scope = timeline.scope("Create pipeline");
+        renderer = std::make_shared<Renderer>(pArgs);
+    }
+    std::shared_ptr<SceneManager> sceneManager;
+    {
+        auto scope = timeline.scope("Wait for scene");
+        auto [pPagedScene, scene] = sceneLoad.get();
+        if (pPagedScene)
+            renderer->setScene(pPagedScene);
+        else
+        {
+            // Scenes other than the first load, and reload after eviction, without reports
+            auto loader = [&](const std::string &path, const SceneManager::Reserve &reserve)
+            {
+                auto pSceneArgs = std::make_shared<RadFoamVulkanArgs>(argparse::parse<RadFoamVulkanArgs>(argc, argv));
+                pSceneArgs->scenePath = path;
+                return loadResidentScene(pSceneArgs, timeline, " (" + path + ")", false, reserve);
+            };
+            sceneManager = std::make_shared<SceneManager>(renderer, size_t(pArgs->sceneBudget) << 20, loader);
+            sceneManager->adopt(scenePaths[0], scene);
+            sceneManager->select(scenePaths[0]);
+        }
+    }
+    if (sceneManager)
+    {
+        auto scope = timeline.scope("Prefetch scenes");
+        for (size_t i = 1; i < scenePaths.size(); ++i)
+            sceneManager->prefetch(scenePaths[i]);
+    }
+    timeline.print();
+    if (pArgs->lodReport)
+        renderer->reportLod();
+    if (pArgs->shReport || pArgs->variableSh)
+        renderer->reportShCompression();
+    if (pArgs->positionReport)
+        renderer->reportPositionQuantization();
+    if (pArgs->facePlaneReport)
+        renderer->reportFacePlanes();
+    if (pArgs->paddedAdjacencyReport)
+        renderer->reportPaddedAdjacency();
+    renderer->benchmark(pArgs->benchmarkFrames);
 
-    auto renderer = std::make_shared<Renderer>(pArgs, pModel, pAABB);
     auto &context = VulkanContext::getContext();
-        
-    // renderer->render();
-
     while (!glfwWindowShouldClose(context.getWindow()))
     {
         glfwPollEvents();
+        // Number keys switch between scenes, keeping the view
+        for (size_t i = 0; sceneManager && i < scenePaths.size(); ++i)
+            if (glfwGetKey(context.getWindow(), GLFW_KEY_1 + int(i)) == GLFW_PRESS)
+                sceneManager->select(scenePaths[i]);
         renderer->render();
         TitleFps();
     }   
 
+    if (sceneManager && scenePaths.size() > 1)
+        sceneManager->printStats();
     terminateWindow();
     return 0;
 }
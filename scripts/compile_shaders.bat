@@ -33,4 +33,13 @@ for /r "%SHADER_DIR%" %%f in (*.vert *.frag *.comp) do (
     )
 )
 
+rem Ray tracing without non-uniform indexing of the scene stream arrays, see Renderer::createRayTracingPipeline
+"%GLSLANG_VALIDATOR%" -V -DUNIFORM_STREAMS "%SHADER_DIR%/ray_tracing.comp" -o "%OUTPUT_DIR%\ray_tracing_uniform.comp.spv"
+if errorlevel 1 (
+    echo Failed to compile %SHADER_DIR%/ray_tracing.comp with UNIFORM_STREAMS
+    exit /b 1
+) else (
+    echo Compiled %SHADER_DIR%/ray_tracing.comp to %OUTPUT_DIR%\ray_tracing_uniform.comp.spv
+)
+
 echo All shaders compiled successfully.
\ No newline at end of file
@@ -94,13 +94,14 @@ void initializeWindow(std::shared_ptr<RadFoamVulkanArgs> pArgs)
     if (pArgs->validation)
         context.createDebugMessenger();
 
-    context.getPhysicalDevices();
+    context.getPhysicalDevices(pArgs->deviceIndex);
     context.createLogicalDevice();
     context.createSwapChain();
 
     context.createCommandPool();
     context.createDescriptorSetPool();
     context.createVMAAllocator();
+    context.markDeviceReady();
     // context.setModel(std::make_shared<RadFoam>(pArgs));
     // context.getModel()->loadRadFoam();
 }
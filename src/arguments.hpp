@@ -19,11 +19,46 @@
 struct RadFoamVulkanArgs : public argparse::Args
 {
     std::string &scenePath = arg("path to radfoam's output ply file");
+    std::string &extraScenes = kwarg("scenes", "comma-separated further scenes, number keys switch between them").set_default("");
+    uint32_t &sceneBudget = kwarg("sceneBudget", "MB of device memory for resident scenes, least recently used ones are evicted past it; 0 keeps up to 4").set_default(0u);
     bool &validation = flag("validation", "enable vulkan vadilation layer");
+    uint32_t &deviceIndex = kwarg("device", "index of the Vulkan physical device, e.g. a software implementation such as lavapipe").set_default(0u);
     uint32_t &windowWidth = kwarg("width", "Init Window Width").set_default(780u);
     uint32_t &windowHeight = kwarg("height", "Init Window Height").set_default(520u);
     uint32_t &framesInFlight = kwarg("framesInFlight", "the number of frames in one flight").set_default(1u);
     bool &fullScreen = flag("fullScreen", "enable full screen window");
     bool &isResizable = flag("resizable", "enable resizable window");
+    std::string &cachePath = kwarg("cache", "scene cache file, empty for <scene>.rfcache").set_default("");
+    bool &noCache = flag("noCache", "always load the PLY and never read or write the scene cache");
+    std::string &packPath = kwarg("writePack", "write the loaded scene to a compressed .rfpack container").set_default("");
+    bool &lowMemory = flag("lowMemory", "release host scene copies after upload, keeping positions only");
+    bool &quantizePositions = flag("quantizePositions", "with --lowMemory, keep host positions as 16-bit integers");
+    float &lodScale = kwarg("lod", "switch to coarser cells once they span fewer than this many pixels, 0 disables").set_default(0.0f);
+    bool &lodReport = flag("lodReport", "compare LOD renders against full resolution at startup");
+    bool &halfSh = flag("halfSh", "store SH coefficients as float16 on the GPU");
+    uint32_t &shCodebook = kwarg("shCodebook", "replace higher SH bands by a codebook of this many entries (at most 4096), 0 disables").set_default(0u);
+    bool &variableSh = flag("variableSh", "store per cell only the SH bands with energy above --shBandEnergy, none at or below --shMinDensity");
+    float &shBandEnergy = kwarg("shBandEnergy", "with --variableSh, sum of squared coefficients below which a band is dropped").set_default(1e-4f);
+    float &shMinDensity = kwarg("shMinDensity", "with --variableSh, cells with at most this density store no SH and are rendered as empty").set_default(0.0f);
+    bool &shReport = flag("shReport", "with --halfSh, --shCodebook or --variableSh, compare against the float32 render at startup");
+    bool &facePlanes = flag("facePlanes", "precompute one plane per adjacency entry instead of reading neighbour positions");
+    bool &facePlaneReport = flag("facePlaneReport", "with --facePlanes, time frames with and without them at startup");
+    bool &sharedFaces = flag("sharedFaces", "store every face once in a face table referenced by both cells, with --facePlanes one plane per face");
+    bool &paddedAdjacency = flag("paddedAdjacency", "store neighbours in fixed-stride blocks with an overflow list instead of CSR");
+    bool &paddedAdjacencyReport = flag("paddedAdjacencyReport", "with --paddedAdjacency, time frames against CSR at startup");
+    bool &deltaAdjacency = flag("deltaAdjacency", "store neighbours as 16-bit offsets to their cell with a 32-bit overflow table");
+    uint32_t &positionBits = kwarg("positionBits", "store GPU positions as fixed point with this many bits per axis (8-21), 0 keeps float32").set_default(0u);
+    bool &positionReport = flag("positionReport", "with --positionBits, compare against float32 positions at startup");
+    bool &autoQuality = flag("autoQuality", "pick float16 SH, fewer SH bands and face planes to fit the free device memory");
+    uint32_t &pageBudget = kwarg("pageBudget", "stream the scene through this many MB of device memory, 0 uploads it whole").set_default(0u);
+    uint32_t &benchmarkFrames = kwarg("benchmark", "time this many offscreen frames at startup and print rays per second").set_default(0u);
     // bool &limitFrameRate = flag("limitFrameRate", "enable limit frame rate");
 };
+
+struct RadFoamConvertArgs : public argparse::Args
+{
+    std::string &inputPath = arg("RadFoam PLY to convert");
+    std::string &outputPath = arg("output file: .ply for a viewer-ready PLY, .rfpack for a compressed scene pack");
+    bool &planarSh = flag("planarSh", "input color_sh_N stores each channel's coefficients contiguously");
+    std::string &reorder = kwarg("reorder", "sort cells along a space-filling curve (morton or hilbert) and write the permutation to <output>.perm").set_default("");
+};
@@ -1,4 +1,5 @@
 #include "buffer.hpp"
+#include <algorithm>
 
 Buffer::Buffer(VkDeviceSize size, VkBufferUsageFlags usage,
                VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags memoryFlags,
@@ -17,14 +18,19 @@ Buffer::Buffer(VkDeviceSize size, VkBufferUsageFlags usage,
 
     if (hostVisible)
     {
-        allocCI.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        // Buffers the host reads back ask for random access instead of write-combined memory
+        if (!(memoryFlags & VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT))
+            allocCI.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
         allocCI.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     }
 
     auto allocator = VulkanContext::getContext().getAllocator();
-    ERR_GUARD_VULKAN(vmaCreateBuffer(allocator, &bufferCI, &allocCI,
-                                     &buffer, &allocation, nullptr));
+    VkResult result = vmaCreateBuffer(allocator, &bufferCI, &allocCI, &buffer, &allocation, nullptr);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY)
+        throw std::runtime_error(std::format("Out of memory for a buffer of {}MB, {}MB of device memory available",
+                                             size >> 20, VulkanContext::getContext().getAvailableDeviceMemory() >> 20));
+    ERR_GUARD_VULKAN(result);
 
     if (hostVisible)
     {
@@ -45,16 +51,25 @@ Buffer::~Buffer()
     }
 }
 
+VkDeviceSize Buffer::getAllocationSize() const
+{
+    VmaAllocationInfo info{};
+    vmaGetAllocationInfo(VulkanContext::getContext().getAllocator(), allocation, &info);
+    return info.size;
+}
+
 void Buffer::uploadData(const void *data, VkDeviceSize dataSize, VkDeviceSize offset)
 {
     assert(offset + dataSize <= size && "Data exceeds buffer size");
+    if (dataSize == 0)
+        return;
     if (hostVisible)
     {
         memcpy(static_cast<char *>(mappedData) + offset, data, dataSize);
         return;
     }
 
-    Buffer stagingBuffer(size,
+    Buffer stagingBuffer(std::min(dataSize, maxStagingSize),
                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                          VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
                          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
@@ -63,20 +78,26 @@ void Buffer::uploadData(const void *data, VkDeviceSize dataSize, VkDeviceSize of
     auto &context = VulkanContext::getContext();
     auto allocator = context.getAllocator();
 
-    void *mappedData;
-    vmaMapMemory(allocator, stagingBuffer.allocation, &mappedData);
-    memcpy(static_cast<char *>(mappedData) + offset, data, static_cast<size_t>(dataSize));
-    vmaUnmapMemory(allocator, stagingBuffer.allocation);
-
-    auto cmd = context.beginSingleTimeCommands();
-    VkBufferCopy copyRegion{0, 0, size};
-    vkCmdCopyBuffer(cmd, stagingBuffer.buffer, buffer, 1, &copyRegion);
-    context.endSingleTimeCommands(cmd);
+    for (VkDeviceSize done = 0; done < dataSize; done += stagingBuffer.size)
+    {
+        VkDeviceSize chunkSize = std::min(stagingBuffer.size, dataSize - done);
+        void *mappedData;
+        vmaMapMemory(allocator, stagingBuffer.allocation, &mappedData);
+        memcpy(mappedData, static_cast<const char *>(data) + done, static_cast<size_t>(chunkSize));
+        vmaUnmapMemory(allocator, stagingBuffer.allocation);
+
+        auto cmd = context.beginSingleTimeCommands();
+        VkBufferCopy copyRegion{0, offset + done, chunkSize};
+        vkCmdCopyBuffer(cmd, stagingBuffer.buffer, buffer, 1, &copyRegion);
+        context.endSingleTimeCommands(cmd);
+    }
 }
 
 void Buffer::downloadData(void *data, VkDeviceSize dataSize, VkDeviceSize offset)
 {
-    assert(dataSize <= size && "Data size exceeds buffer capacity");
+    assert(offset + dataSize <= size && "Data size exceeds buffer capacity");
+    if (dataSize == 0)
+        return;
 
     if (hostVisible)
     {
@@ -84,7 +105,7 @@ void Buffer::downloadData(void *data, VkDeviceSize dataSize, VkDeviceSize offset
         return;
     }
 
-    Buffer stagingBuffer(dataSize,
+    Buffer stagingBuffer(std::min(dataSize, maxStagingSize),
                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                          VMA_MEMORY_USAGE_CPU_ONLY,
                          VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
@@ -92,15 +113,19 @@ void Buffer::downloadData(void *data, VkDeviceSize dataSize, VkDeviceSize offset
     auto &context = VulkanContext::getContext();
     auto allocator = context.getAllocator();
 
-    auto cmd = context.beginSingleTimeCommands();
-    VkBufferCopy copyRegion{0, 0, size};
-    vkCmdCopyBuffer(cmd, buffer, stagingBuffer.buffer, 1, &copyRegion);
-    context.endSingleTimeCommands(cmd);
-
-    void *mappedData;
-    vmaMapMemory(allocator, stagingBuffer.allocation, &mappedData);
-    memcpy(data, static_cast<char *>(mappedData) + offset, dataSize);
-    vmaUnmapMemory(allocator, stagingBuffer.allocation);
+    for (VkDeviceSize done = 0; done < dataSize; done += stagingBuffer.size)
+    {
+        VkDeviceSize chunkSize = std::min(stagingBuffer.size, dataSize - done);
+        auto cmd = context.beginSingleTimeCommands();
+        VkBufferCopy copyRegion{offset + done, 0, chunkSize};
+        vkCmdCopyBuffer(cmd, buffer, stagingBuffer.buffer, 1, &copyRegion);
+        context.endSingleTimeCommands(cmd);
+
+        void *mappedData;
+        vmaMapMemory(allocator, stagingBuffer.allocation, &mappedData);
+        memcpy(static_cast<char *>(data) + done, mappedData, static_cast<size_t>(chunkSize));
+        vmaUnmapMemory(allocator, stagingBuffer.allocation);
+    }
 }
 
 Image::Image(VkImageType type, VkFormat format, VkExtent3D extent,
@@ -127,10 +152,23 @@ Image::Image(VkImageType type, VkFormat format, VkExtent3D extent,
     auto allocator = VulkanContext::getContext().getAllocator();
     ERR_GUARD_VULKAN(vmaCreateImage(allocator, &imageCI, &allocCI,
                                     &image, &allocation, nullptr));
+
+    if (type == VK_IMAGE_TYPE_2D)
+    {
+        VkImageViewCreateInfo viewCI{};
+        viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewCI.image = image;
+        viewCI.viewType = arrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+        viewCI.format = format;
+        viewCI.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, arrayLayers};
+        ERR_GUARD_VULKAN(vkCreateImageView(VulkanContext::getContext().getDevice(), &viewCI, nullptr, &view));
+    }
 }
 
 Image::~Image()
 {
+    if (view != VK_NULL_HANDLE)
+        vkDestroyImageView(VulkanContext::getContext().getDevice(), view, nullptr);
     if (image != VK_NULL_HANDLE)
     {
         auto allocator = VulkanContext::getContext().getAllocator();
@@ -5,6 +5,10 @@
 class Buffer
 {
 public:
+    // Device-local transfers go through a staging buffer of at most this size, so buffers past
+    // 4GB upload without an equally large host allocation
+    static constexpr VkDeviceSize maxStagingSize = VkDeviceSize(256) << 20;
+
     Buffer() = default;
     Buffer(VkDeviceSize size, VkBufferUsageFlags usage,
            VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags memoryFlags = 0,
@@ -16,6 +20,8 @@ public:
 
     VkBuffer getBuffer() const { return buffer; }
     VkDeviceSize getSize() const { return size; }
+    // Device memory VMA set aside for the buffer, at least its size
+    VkDeviceSize getAllocationSize() const;
 
     // private:
     VkBuffer buffer = VK_NULL_HANDLE;
@@ -47,12 +53,14 @@ class Image {
         //                      VkPipelineStageFlags dstStageMask);
 
         VkImage getImage() const { return image; }
+        VkImageView getView() const { return view; }
         VkFormat getFormat() const { return format; }
         VkExtent3D getExtent() const { return extent; }
         VkImageLayout getLayout() const { return currentLayout; }
     
     private:
         VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE; // Color view of 2D images
         VmaAllocation allocation = VK_NULL_HANDLE;
         VkFormat format = VK_FORMAT_UNDEFINED;
         VkExtent3D extent = {0, 0, 0};
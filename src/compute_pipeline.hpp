@@ -45,12 +45,18 @@ public:
             .descriptorSetCount = 1,
             .pSetLayouts = &layout};
 
+        std::lock_guard lock(context.getDescriptorPoolMutex());
         vkAllocateDescriptorSets(VulkanContext::getContext().getDevice(), &allocInfo, &set);
     }
 
     ~DescriptorSet()
     {
-        vkDestroyDescriptorSetLayout(VulkanContext::getContext().getDevice(), layout, nullptr);
+        auto &context = VulkanContext::getContext();
+        {
+            std::lock_guard lock(context.getDescriptorPoolMutex());
+            vkFreeDescriptorSets(context.getDevice(), context.getDescriptorPool(), 1, &set);
+        }
+        vkDestroyDescriptorSetLayout(context.getDevice(), layout, nullptr);
     }
 
     void bindBuffers(uint32_t binding, const std::vector<VkBuffer> &buffers,
@@ -0,0 +1,489 @@
+#include "foam_lod.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    constexpr char lodMagic[8] = {'R', 'F', 'L', 'O', 'D', '\0', '\0', '\0'};
+
+    // A level is only kept when it has noticeably fewer cells than the one below
+    constexpr double minReduction = 1.5;
+    constexpr uint64_t minLevelSize = 64;
+    constexpr size_t cellsPerBatch = 1 << 18;
+    // Cells per coarse cell assumed when projecting a hierarchy that has not been built yet
+    constexpr double estimatedReduction = 4.0;
+}
+
+std::string FoamLod::getPath(const RadFoamVulkanArgs &args)
+{
+    return std::filesystem::path(args.scenePath).replace_extension(".rflod").string();
+}
+
+std::pair<uint64_t, uint64_t> FoamLod::projectCoarseCounts(const RadFoamVulkanArgs &args, uint64_t numFineCells,
+                                                           uint64_t numFineAdjacency)
+{
+    auto path = getPath(args);
+    Header stored{};
+    if (!args.noCache && std::filesystem::exists(path))
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        ifs.read(reinterpret_cast<char *>(&stored), sizeof(Header));
+        if (ifs && std::memcmp(stored.magic, lodMagic, sizeof(lodMagic)) == 0 && stored.version == formatVersion &&
+            stored.source == SceneCache::getSourceStamp(args.scenePath) && stored.numFineCells == numFineCells &&
+            stored.numFineAdjacency == numFineAdjacency)
+            return {stored.numCoarseCells, stored.numCoarseAdjacency};
+    }
+
+    uint64_t numCoarseCells = 0, numCoarseAdjacency = 0;
+    double cells = double(numFineCells), adjacency = double(numFineAdjacency);
+    for (uint32_t level = 1; level < maxLevels && cells / estimatedReduction >= minLevelSize; ++level)
+    {
+        cells /= estimatedReduction;
+        adjacency /= estimatedReduction;
+        numCoarseCells += static_cast<uint64_t>(cells);
+        numCoarseAdjacency += static_cast<uint64_t>(adjacency);
+    }
+    return {numCoarseCells, numCoarseAdjacency};
+}
+
+FoamLod::FoamLod(const RadFoamVulkanArgs &args, RadFoam &model)
+{
+    if (!args.noCache && load(args, model))
+        return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    header = {};
+    std::memcpy(header.magic, lodMagic, sizeof(lodMagic));
+    header.version = formatVersion;
+    header.source = SceneCache::getSourceStamp(args.scenePath);
+    header.numFineCells = model.getNumVertices();
+    header.numFineAdjacency = model.getNumAdjacency();
+    header.shDegree = model.getShDegree();
+    build(model);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    std::string levels;
+    for (uint32_t level = 0; level < header.numLevels; ++level)
+        levels += std::format("{}{}", level ? " -> " : "", getLevelSize(level));
+    std::cout << std::format("LOD hierarchy built in {}ms: {} cells per level\n",
+                             std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count(),
+                             levels);
+    // The file holds the source SH, which a scene loaded in a leaner format no longer has
+    if (!args.noCache && model.hasSourceSh())
+        save(getPath(args));
+}
+
+void FoamLod::build(RadFoam &model)
+{
+    uint32_t numCells = static_cast<uint32_t>(model.getNumVertices());
+    if (model.getPositions().size() != numCells)
+        throw std::runtime_error("LOD hierarchy needs the host positions of the scene");
+    model.requireAdjacency32("LOD hierarchy");
+
+    // Fine level: positions are on the host, cell records and adjacency are read back
+    Level fine;
+    fine.positions = model.getPositions();
+    fine.densities.resize(numCells);
+    fine.adjacencyEnd.resize(numCells);
+    std::vector<RadFoam::RadFoamCell> cells;
+    for (size_t first = 0; first < numCells; first += cellsPerBatch)
+    {
+        size_t count = std::min<size_t>(cellsPerBatch, numCells - first);
+        cells.resize(count);
+        model.getCellBuffer()->downloadData(cells.data(), count * sizeof(RadFoam::RadFoamCell),
+                                            first * sizeof(RadFoam::RadFoamCell));
+        for (size_t i = 0; i < count; ++i)
+        {
+            fine.densities[first + i] = cells[i].density;
+            fine.adjacencyEnd[first + i] = cells[i].adjacencyEnd;
+        }
+    }
+    fine.adjacency.resize(model.getNumAdjacency());
+    if (!fine.adjacency.empty())
+        model.getAdjacencyBuffer()->downloadData(fine.adjacency.data(), fine.adjacency.size() * sizeof(uint32_t));
+
+    // Half the mean distance to the neighbours stands in for the cell radius
+    fine.radii.resize(numCells);
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint32_t adjacencyBegin = i ? fine.adjacencyEnd[i - 1] : 0;
+            uint32_t numNeighbours = fine.adjacencyEnd[i] - adjacencyBegin;
+            float sum = 0.0f;
+            for (uint32_t k = adjacencyBegin; k < fine.adjacencyEnd[i]; ++k)
+                sum += glm::distance(fine.positions[i], fine.positions[fine.adjacency[k]]);
+            fine.radii[i] = numNeighbours ? 0.5f * sum / numNeighbours : 0.0f;
+        } });
+
+    nodes.resize(numCells);
+    for (uint32_t i = 0; i < numCells; ++i)
+        nodes[i] = {noParent, 2.0f * fine.radii[i]};
+
+    header.numLevels = 1;
+    header.levelOffsets[0] = 0;
+    header.levelOffsets[1] = numCells;
+    uint32_t numShCoeffs = model.getNumShCoeffs();
+    while (header.numLevels < maxLevels)
+    {
+        uint64_t fineOffset = header.levelOffsets[header.numLevels - 1];
+        uint64_t coarseOffset = header.levelOffsets[header.numLevels];
+        Level coarse = coarsen(fine, fineOffset, coarseOffset, nodes.data() + fineOffset, model);
+
+        size_t numFine = fine.positions.size(), numCoarse = coarse.positions.size();
+        if (numCoarse < minLevelSize || numFine < minReduction * numCoarse)
+        {
+            for (size_t i = 0; i < numFine; ++i)
+                nodes[fineOffset + i].parent = noParent;
+            break;
+        }
+
+        // Coarse ranges continue after the fine adjacency so that the shader needs no special case
+        uint64_t adjacencyBase = header.numFineAdjacency + coarseAdjacency.size();
+        for (size_t i = 0; i < numCoarse; ++i)
+        {
+            uint32_t adjacencyBegin = i ? coarse.adjacencyEnd[i - 1] : 0;
+            coarsePositions.push_back(glm::vec4(coarse.positions[i], 0.0f));
+            coarseCells.push_back({coarse.densities[i], static_cast<uint32_t>(adjacencyBase + adjacencyBegin),
+                                   static_cast<uint32_t>(adjacencyBase + coarse.adjacencyEnd[i])});
+            nodes.push_back({noParent, 2.0f * coarse.radii[i]});
+        }
+        coarseSh.insert(coarseSh.end(), coarse.sh.begin(), coarse.sh.end());
+        coarseAdjacency.insert(coarseAdjacency.end(), coarse.adjacency.begin(), coarse.adjacency.end());
+        if (adjacencyBase + coarse.adjacency.size() > UINT32_MAX)
+            throw std::runtime_error("LOD hierarchy exceeds 32-bit adjacency offsets");
+
+        header.numLevels++;
+        header.levelOffsets[header.numLevels] = coarseOffset + numCoarse;
+        fine = std::move(coarse);
+    }
+
+    header.numCoarseCells = coarseCells.size();
+    header.numCoarseAdjacency = coarseAdjacency.size();
+    assert(coarseSh.size() == header.numCoarseCells * numShCoeffs);
+}
+
+FoamLod::Level FoamLod::coarsen(const Level &fine, uint64_t fineOffset, uint64_t coarseOffset, Node *fineNodes,
+                                RadFoam &model) const
+{
+    size_t numFine = fine.positions.size();
+    auto neighbours = [&](size_t i)
+    {
+        uint32_t begin = i ? fine.adjacencyEnd[i - 1] : 0;
+        return std::pair{fine.adjacency.data() + begin, fine.adjacency.data() + fine.adjacencyEnd[i]};
+    };
+
+    // Aggregation: seed a coarse cell wherever a cell and all its neighbours are still free,
+    // attach the leftovers to the closest aggregated neighbour and keep isolated cells alone
+    std::vector<uint32_t> assign(numFine, noParent);
+    uint32_t numCoarse = 0;
+    for (size_t i = 0; i < numFine; ++i)
+    {
+        auto [first, last] = neighbours(i);
+        if (assign[i] != noParent ||
+            std::any_of(first, last, [&](uint32_t j)
+                        { return assign[j - fineOffset] != noParent; }))
+            continue;
+        assign[i] = numCoarse;
+        for (auto it = first; it != last; ++it)
+            assign[*it - fineOffset] = numCoarse;
+        numCoarse++;
+    }
+    std::vector<uint32_t> seeded = assign;
+    for (size_t i = 0; i < numFine; ++i)
+    {
+        if (assign[i] != noParent)
+            continue;
+        float bestDistance = INFINITY;
+        auto [first, last] = neighbours(i);
+        for (auto it = first; it != last; ++it)
+        {
+            float distance = glm::distance(fine.positions[i], fine.positions[*it - fineOffset]);
+            if (seeded[*it - fineOffset] != noParent && distance < bestDistance)
+                bestDistance = distance, assign[i] = seeded[*it - fineOffset];
+        }
+        if (assign[i] == noParent)
+            assign[i] = numCoarse++;
+    }
+    seeded = {};
+
+    // Members of every aggregate, in fine order
+    std::vector<uint32_t> memberBegin(numCoarse + 1, 0);
+    for (size_t i = 0; i < numFine; ++i)
+        memberBegin[assign[i] + 1]++;
+    for (uint32_t a = 0; a < numCoarse; ++a)
+        memberBegin[a + 1] += memberBegin[a];
+    std::vector<uint32_t> members(numFine);
+    {
+        std::vector<uint32_t> cursor(memberBegin.begin(), memberBegin.end() - 1);
+        for (size_t i = 0; i < numFine; ++i)
+            members[cursor[assign[i]]++] = static_cast<uint32_t>(i);
+    }
+    for (size_t i = 0; i < numFine; ++i)
+        fineNodes[i].parent = static_cast<uint32_t>(coarseOffset + assign[i]);
+
+    // Volume weights for position and density; SH are additionally weighted by the opacity of
+    // each child so that empty space does not wash out the color of the surfaces it surrounds
+    auto volume = [&](size_t i)
+    { return fine.radii[i] * fine.radii[i] * fine.radii[i] + 1e-20f; };
+    std::vector<float> shWeights(numFine);
+    parallelFor(numFine, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            float opacity = 1.0f - std::exp(-fine.densities[i] * 2.0f * fine.radii[i]);
+            shWeights[i] = volume(i) * (opacity + 1e-4f);
+        } });
+
+    Level coarse;
+    coarse.positions.resize(numCoarse);
+    coarse.densities.resize(numCoarse);
+    coarse.radii.resize(numCoarse);
+    coarse.adjacencyEnd.resize(numCoarse);
+    std::vector<float> shWeightSums(numCoarse);
+
+    // Adjacency is the union of the children's neighbour aggregates; counted first, then written
+    auto collectNeighbours = [&](uint32_t a, std::vector<uint32_t> &out)
+    {
+        out.clear();
+        for (uint32_t m = memberBegin[a]; m < memberBegin[a + 1]; ++m)
+        {
+            auto [first, last] = neighbours(members[m]);
+            for (auto it = first; it != last; ++it)
+            {
+                uint32_t b = assign[*it - fineOffset];
+                if (b != a)
+                    out.push_back(static_cast<uint32_t>(coarseOffset + b));
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+
+    parallelFor(numCoarse, [&](size_t begin, size_t end)
+                {
+        std::vector<uint32_t> scratch;
+        for (size_t a = begin; a < end; ++a)
+        {
+            float weightSum = 0.0f, shWeightSum = 0.0f, density = 0.0f;
+            glm::vec3 centroid(0.0f);
+            for (uint32_t m = memberBegin[a]; m < memberBegin[a + 1]; ++m)
+            {
+                uint32_t i = members[m];
+                float w = volume(i);
+                weightSum += w;
+                shWeightSum += shWeights[i];
+                centroid += w * fine.positions[i];
+                density += w * fine.densities[i];
+            }
+            centroid /= weightSum;
+
+            float radius = 0.0f;
+            for (uint32_t m = memberBegin[a]; m < memberBegin[a + 1]; ++m)
+            {
+                uint32_t i = members[m];
+                radius = std::max(radius, glm::distance(centroid, fine.positions[i]) + fine.radii[i]);
+            }
+
+            coarse.positions[a] = centroid;
+            coarse.densities[a] = density / weightSum;
+            coarse.radii[a] = radius;
+            shWeightSums[a] = shWeightSum;
+            collectNeighbours(static_cast<uint32_t>(a), scratch);
+            coarse.adjacencyEnd[a] = static_cast<uint32_t>(scratch.size());
+        } }, 1024);
+
+    for (uint32_t a = 1; a < numCoarse; ++a)
+        coarse.adjacencyEnd[a] += coarse.adjacencyEnd[a - 1];
+    coarse.adjacency.resize(numCoarse ? coarse.adjacencyEnd.back() : 0);
+    parallelFor(numCoarse, [&](size_t begin, size_t end)
+                {
+        std::vector<uint32_t> scratch;
+        for (size_t a = begin; a < end; ++a)
+        {
+            collectNeighbours(static_cast<uint32_t>(a), scratch);
+            std::copy(scratch.begin(), scratch.end(), coarse.adjacency.begin() + (a ? coarse.adjacencyEnd[a - 1] : 0));
+        } }, 1024);
+
+    // SH: every thread owns a range of coefficients, so children accumulate without conflicts
+    uint32_t numShCoeffs = model.getNumShCoeffs();
+    coarse.sh.assign(size_t(numCoarse) * numShCoeffs, 0.0f);
+    auto accumulate = [&](const float *sh, size_t first, size_t count)
+    {
+        parallelFor(numShCoeffs, [&](size_t c0, size_t c1)
+                    {
+            for (size_t i = 0; i < count; ++i)
+            {
+                float w = shWeights[first + i];
+                float *dst = coarse.sh.data() + size_t(assign[first + i]) * numShCoeffs;
+                const float *src = sh + i * numShCoeffs;
+                for (size_t c = c0; c < c1; ++c)
+                    dst[c] += w * src[c];
+            } }, 1);
+    };
+    if (!fine.sh.empty())
+        accumulate(fine.sh.data(), 0, numFine);
+    else
+    {
+        std::vector<float> batch;
+        std::vector<uint32_t> words;
+        uint32_t wordsPerCell = RadFoam::getShHalfWords(numShCoeffs);
+        for (size_t first = 0; first < numFine; first += cellsPerBatch)
+        {
+            size_t count = std::min<size_t>(cellsPerBatch, numFine - first);
+            batch.resize(count * numShCoeffs);
+            if (model.isShHalf())
+            {
+                words.resize(count * wordsPerCell);
+                model.getShBuffer()->downloadData(words.data(), words.size() * sizeof(uint32_t),
+                                                  first * wordsPerCell * sizeof(uint32_t));
+                RadFoam::unpackShHalf(words.data(), count, numShCoeffs, batch.data());
+            }
+            else
+                model.getShBuffer()->downloadData(batch.data(), batch.size() * sizeof(float),
+                                                  first * numShCoeffs * sizeof(float));
+            accumulate(batch.data(), first, count);
+        }
+    }
+    parallelFor(numCoarse, [&](size_t begin, size_t end)
+                {
+        for (size_t a = begin; a < end; ++a)
+            for (uint32_t c = 0; c < numShCoeffs; ++c)
+                coarse.sh[a * numShCoeffs + c] /= shWeightSums[a];
+        });
+
+    return coarse;
+}
+
+void FoamLod::attach(RadFoam &model)
+{
+    uint32_t numShCoeffs = model.getNumShCoeffs();
+    assert(coarseSh.size() == coarseCells.size() * numShCoeffs);
+    // Coarse SH follow the format the scene was loaded in
+    const void *coarseShData = coarseSh.data();
+    size_t coarseShSize = coarseSh.size() * sizeof(float);
+    std::vector<uint32_t> coarseShHalf;
+    if (model.isShHalf())
+    {
+        coarseShHalf.resize(coarseCells.size() * RadFoam::getShHalfWords(numShCoeffs));
+        RadFoam::packShHalf(coarseSh.data(), coarseCells.size(), numShCoeffs, coarseShHalf.data(), numShCoeffs);
+        coarseShData = coarseShHalf.data();
+        coarseShSize = coarseShHalf.size() * sizeof(uint32_t);
+    }
+    struct Stream
+    {
+        std::shared_ptr<Buffer> &buffer;
+        const void *coarseData;
+        size_t coarseSize;
+    };
+    Stream streams[] = {
+        {model.positionBuffer, coarsePositions.data(), coarsePositions.size() * sizeof(glm::vec4)},
+        {model.cellBuffer, coarseCells.data(), coarseCells.size() * sizeof(RadFoam::RadFoamCell)},
+        {model.shBuffer, coarseShData, coarseShSize},
+        {model.adjacencyBuffer, coarseAdjacency.data(), coarseAdjacency.size() * sizeof(uint32_t)},
+    };
+
+    // Fine cells are copied on the device, the coarse ones uploaded behind them
+    auto &context = VulkanContext::getContext();
+    auto usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    std::shared_ptr<Buffer> extended[std::size(streams)];
+    auto cmd = context.beginSingleTimeCommands();
+    for (size_t s = 0; s < std::size(streams); ++s)
+    {
+        auto fineSize = streams[s].buffer->getSize();
+        extended[s] = std::make_shared<Buffer>(fineSize + streams[s].coarseSize, usage,
+                                               VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+        VkBufferCopy region{0, 0, fineSize};
+        vkCmdCopyBuffer(cmd, streams[s].buffer->getBuffer(), extended[s]->getBuffer(), 1, &region);
+    }
+    context.endSingleTimeCommands(cmd);
+
+    for (size_t s = 0; s < std::size(streams); ++s)
+    {
+        if (streams[s].coarseSize)
+            extended[s]->uploadData(streams[s].coarseData, streams[s].coarseSize, streams[s].buffer->getSize());
+        streams[s].buffer = extended[s];
+    }
+
+    nodeBuffer = std::make_shared<Buffer>(nodes.size() * sizeof(Node),
+                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                          VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    nodeBuffer->uploadData(nodes.data(), nodes.size() * sizeof(Node));
+
+    coarsePositions = {};
+    coarseCells = {};
+    coarseSh = {};
+    coarseAdjacency = {};
+    nodes = {};
+}
+
+bool FoamLod::load(const RadFoamVulkanArgs &args, RadFoam &model)
+{
+    auto path = getPath(args);
+    if (!std::filesystem::exists(path))
+        return false;
+
+    SceneCache::FileCheck check("LOD hierarchy", path);
+    MappedFile file(path);
+    if (file.size() < sizeof(Header))
+        return check.reject("truncated");
+    std::memcpy(&header, file.data(), sizeof(Header));
+    if (!check.checkHeader(header, lodMagic, formatVersion, SceneCache::getSourceStamp(args.scenePath)))
+        return false;
+    if (header.numFineCells != model.getNumVertices() || header.numFineAdjacency != model.getNumAdjacency() ||
+        header.shDegree != model.getSourceShDegree() || header.numLevels == 0 || header.numLevels > maxLevels ||
+        header.levelOffsets[header.numLevels] != header.numFineCells + header.numCoarseCells)
+        return check.reject("does not match the scene");
+
+    // Stored with the source SH; a scene loaded with fewer bands keeps the leading ones
+    size_t numShCoeffs = 3 * (header.shDegree + 1) * (header.shDegree + 1);
+    size_t numNodes = header.numFineCells + header.numCoarseCells;
+    size_t payloadSize = header.numCoarseCells * (sizeof(glm::vec4) + sizeof(RadFoam::RadFoamCell) +
+                                                  numShCoeffs * sizeof(float)) +
+                         header.numCoarseAdjacency * sizeof(uint32_t) + numNodes * sizeof(Node);
+    if (!check.checkPayload(file, sizeof(Header), payloadSize, header.contentHash))
+        return false;
+
+    const char *src = file.data() + sizeof(Header);
+    auto read = [&src](auto &dst, size_t count)
+    {
+        dst.resize(count);
+        std::memcpy(dst.data(), src, count * sizeof(dst[0]));
+        src += count * sizeof(dst[0]);
+    };
+    read(coarsePositions, header.numCoarseCells);
+    read(coarseCells, header.numCoarseCells);
+    read(coarseSh, header.numCoarseCells * numShCoeffs);
+    read(coarseAdjacency, header.numCoarseAdjacency);
+    read(nodes, numNodes);
+
+    size_t keptCoeffs = model.getNumShCoeffs();
+    if (keptCoeffs < numShCoeffs)
+    {
+        for (size_t i = 0; i < header.numCoarseCells; ++i)
+            std::memmove(coarseSh.data() + i * keptCoeffs, coarseSh.data() + i * numShCoeffs,
+                         keptCoeffs * sizeof(float));
+        coarseSh.resize(header.numCoarseCells * keptCoeffs);
+    }
+    return true;
+}
+
+void FoamLod::save(const std::string &path) const
+{
+    Header written = header;
+    SceneCache::writeFile(path, "LOD hierarchy", written, sizeof(Header), [this](std::ostream &ofs)
+                          {
+        auto write = [&ofs](const auto &src)
+        { ofs.write(reinterpret_cast<const char *>(src.data()), src.size() * sizeof(src[0])); };
+        write(coarsePositions);
+        write(coarseCells);
+        write(coarseSh);
+        write(coarseAdjacency);
+        write(nodes); });
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "radfoam.hpp"
+#include "scene_cache.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Level-of-detail hierarchy over the foam, stored next to the scene (.rflod).
+// Every coarse cell aggregates a cell of the level below with its still unassigned neighbours:
+// the position is the volume-weighted centroid, density the volume-weighted mean and SH are
+// weighted by the opacity each child contributes. Coarse cells are appended after the fine
+// ones in the scene buffers and link to each other through the same adjacency layout, so the
+// ray tracer walks every level with one code path and climbs to a parent once the parent is
+// smaller than the pixel footprint.
+class FoamLod
+{
+public:
+    static constexpr uint32_t formatVersion = 2;
+    static constexpr uint32_t maxLevels = 6;
+    static constexpr uint32_t noParent = UINT32_MAX;
+
+    // Per cell of every level, read by ray_tracing.comp
+    struct Node
+    {
+        uint32_t parent; // Cell of the next level containing this one, or noParent
+        float size;      // Diameter estimate
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numLevels; // Including the fine level
+        SceneCache::SourceStamp source;
+        uint64_t numFineCells;
+        uint64_t numFineAdjacency;
+        uint32_t shDegree;
+        uint32_t reserved;
+        uint64_t numCoarseCells;
+        uint64_t numCoarseAdjacency;
+        uint64_t levelOffsets[maxLevels + 1]; // First cell of every level
+        uint64_t contentHash;                 // Hash of everything after the header
+    };
+
+    static std::string getPath(const RadFoamVulkanArgs &args);
+    // Coarse cell and adjacency counts of <scene>.rflod when it matches the scene, or an estimate from a
+    // typical reduction between levels, to project device memory before the scene is loaded
+    static std::pair<uint64_t, uint64_t> projectCoarseCounts(const RadFoamVulkanArgs &args, uint64_t numFineCells,
+                                                             uint64_t numFineAdjacency);
+
+    // Loads the hierarchy from <scene>.rflod, or builds it from the model's buffers and writes it
+    FoamLod(const RadFoamVulkanArgs &args, RadFoam &model);
+
+    // Replaces the model's buffers by copies with the coarse cells appended and uploads the nodes.
+    // The model keeps reporting its fine cell and adjacency counts.
+    void attach(RadFoam &model);
+
+    uint32_t getNumLevels() const { return header.numLevels; }
+    uint64_t getNumCoarseCells() const { return header.numCoarseCells; }
+    uint64_t getLevelSize(uint32_t level) const
+    {
+        return header.levelOffsets[level + 1] - header.levelOffsets[level];
+    }
+    auto getNodeBuffer() { return nodeBuffer; }
+
+private:
+    // One level as CSR, adjacency holding global cell indices
+    struct Level
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<float> densities;
+        std::vector<float> radii;
+        std::vector<float> sh;
+        std::vector<uint32_t> adjacencyEnd;
+        std::vector<uint32_t> adjacency;
+    };
+
+    void build(RadFoam &model);
+    // Aggregates one level into the next and links fineNodes to their parents. The fine SH
+    // come from fine.sh, or are read back from the model's buffer when that is empty.
+    Level coarsen(const Level &fine, uint64_t fineOffset, uint64_t coarseOffset, Node *fineNodes,
+                  RadFoam &model) const;
+    bool load(const RadFoamVulkanArgs &args, RadFoam &model);
+    void save(const std::string &path) const;
+
+    Header header{};
+    std::vector<glm::vec4> coarsePositions;
+    std::vector<RadFoam::RadFoamCell> coarseCells;
+    std::vector<float> coarseSh;
+    std::vector<uint32_t> coarseAdjacency;
+    std::vector<Node> nodes; // Fine and coarse cells
+
+    std::shared_ptr<Buffer> nodeBuffer;
+};
@@ -0,0 +1,317 @@
+#include "paged_scene.hpp"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+    using RadFoamCell = RadFoam::RadFoamCell;
+}
+
+PagedScene::PagedScene(const std::string &path, size_t budgetBytes, bool halfSh)
+    : shHalf(halfSh)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    if (ScenePack::isPackPath(path))
+    {
+        pack = std::make_unique<ScenePack>(path);
+        numVertices = pack->getHeader().numVertices;
+        numAdjacency = pack->getHeader().numAdjacency;
+        shDegree = pack->getHeader().shDegree;
+    }
+    else
+    {
+        ply = std::make_unique<RadFoamPly>(path);
+        plyFile = std::make_unique<MappedFile>(path);
+        numVertices = ply->getNumVertices();
+        numAdjacency = ply->getNumAdjacency();
+        shDegree = ply->getShDegree();
+    }
+    // The shader addresses cells with int, adjacency offsets are rebased onto the slots
+    if (numVertices > INT32_MAX)
+        throw std::runtime_error(std::format("Paged scene: {} cells exceed the 31-bit cell ids of the ray tracer",
+                                             numVertices));
+    numShCoeffs = 3 * (shDegree + 1) * (shDegree + 1);
+    shBytesPerCell = shHalf ? RadFoam::getShHalfWords(numShCoeffs) * sizeof(uint32_t) : numShCoeffs * sizeof(float);
+
+    pages.resize((numVertices + cellsPerPage - 1) / cellsPerPage);
+    std::vector<Page> entries(pages.size());
+    scanPages(entries);
+
+    for (auto &page : pages)
+        adjacencyPerSlot = std::max(adjacencyPerSlot, page.numAdjacency);
+    size_t slotBytes = size_t(cellsPerPage) * (sizeof(glm::vec4) + sizeof(RadFoamCell) + shBytesPerCell) +
+                       size_t(adjacencyPerSlot) * sizeof(uint32_t);
+    numSlots = static_cast<uint32_t>(std::min(pages.size(), budgetBytes / slotBytes));
+    if (numSlots == 0)
+        throw std::runtime_error(std::format("Page budget too small: one page needs {}MB", (slotBytes >> 20) + 1));
+    slotPages.assign(numSlots, invalidSlot);
+
+    VulkanContext::getContext().waitForDevice();
+    auto usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    positionPool = std::make_shared<Buffer>(size_t(numSlots) * cellsPerPage * sizeof(glm::vec4), usage,
+                                            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    cellPool = std::make_shared<Buffer>(size_t(numSlots) * cellsPerPage * sizeof(RadFoamCell), usage,
+                                        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    shPool = std::make_shared<Buffer>(size_t(numSlots) * cellsPerPage * shBytesPerCell, usage,
+                                      VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    adjacencyPool = std::make_shared<Buffer>(std::max<size_t>(size_t(numSlots) * adjacencyPerSlot, 1) * sizeof(uint32_t),
+                                             usage, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    // The renderer waits for the previous frame before update(), so both tables are
+    // written and read in place
+    pageTable = std::make_shared<Buffer>(pages.size() * sizeof(Page), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                         VMA_MEMORY_USAGE_AUTO_PREFER_HOST, 0, true);
+    pageEntries = static_cast<Page *>(pageTable->mappedData);
+    std::copy(entries.begin(), entries.end(), pageEntries);
+
+    feedback = std::make_shared<Buffer>(2 * pages.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+                                        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, true);
+    feedbackData = static_cast<const uint32_t *>(feedback->mappedData);
+    std::memset(feedback->mappedData, 0, feedback->getSize());
+
+    uploader = std::make_unique<StreamingUploader>(slotBytes + 64, 2);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << std::format("Paged scene: {} pages of {} cells, {} slots ({}MB of {}MB budget), scanned in {}ms\n",
+                             pages.size(), cellsPerPage, numSlots, (size_t(numSlots) * slotBytes) >> 20,
+                             budgetBytes >> 20,
+                             std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count());
+}
+
+void PagedScene::scanPages(std::vector<Page> &entries)
+{
+    // One pass over the source for page bounds, adjacency ranges and fallback colors
+    std::vector<glm::vec4> positionStream(cellsPerPage);
+    std::vector<RadFoamCell> cells(cellsPerPage);
+    std::vector<float> sh(size_t(cellsPerPage) * numShCoeffs);
+    std::vector<glm::vec3> positions(cellsPerPage);
+    size_t adjacencyBegin = 0;
+
+    for (uint32_t p = 0; p < pages.size(); ++p)
+    {
+        auto &page = pages[p];
+        page.firstCell = size_t(p) * cellsPerPage;
+        page.numCells = static_cast<uint32_t>(std::min<size_t>(cellsPerPage, numVertices - page.firstCell));
+        page.adjacencyBegin = adjacencyBegin;
+        decodePage(p, positionStream.data(), cells.data(), sh.data(), nullptr, positions.data());
+        page.numAdjacency = static_cast<uint32_t>(
+            RadFoam::extendOffset(adjacencyBegin, cells[page.numCells - 1].adjacencyEnd) - adjacencyBegin);
+        adjacencyBegin += page.numAdjacency;
+
+        page.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        page.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (uint32_t i = 0; i < page.numCells; ++i)
+        {
+            page.boundsMin = glm::min(page.boundsMin, positions[i]);
+            page.boundsMax = glm::max(page.boundsMax, positions[i]);
+        }
+
+        // Fallback: DC color weighted by the opacity of a typical cell of this page
+        glm::vec3 extent = page.boundsMax - page.boundsMin;
+        float cellSize = std::cbrt(std::max(extent.x * extent.y * extent.z, 1e-12f) / page.numCells);
+        glm::vec3 color(0);
+        float opacity = 0;
+        for (uint32_t i = 0; i < page.numCells; ++i)
+        {
+            float alpha = 1.0f - std::exp(-cells[i].density * cellSize);
+            glm::vec3 dc(sh[size_t(i) * numShCoeffs], sh[size_t(i) * numShCoeffs + 1], sh[size_t(i) * numShCoeffs + 2]);
+            color += alpha * glm::clamp(0.28209479177387814f * dc + 0.5f, 0.0f, 1.0f);
+            opacity += alpha;
+        }
+        color = opacity > 0 ? color / opacity : glm::vec3(0);
+        opacity /= page.numCells;
+
+        entries[p] = {invalidSlot, glm::packUnorm4x8(glm::vec4(color, opacity))};
+    }
+    if (adjacencyBegin != numAdjacency)
+        throw std::runtime_error("Paged scene: adjacency offsets do not cover the adjacency list");
+}
+
+void PagedScene::decodePage(uint32_t page, glm::vec4 *positions, RadFoamCell *cells, float *sh,
+                            uint32_t *adjacency, glm::vec3 *hostPositions)
+{
+    auto &state = pages[page];
+    if (pack)
+    {
+        constexpr uint32_t blocksPerPage = cellsPerPage / ScenePack::cellsPerBlock;
+        size_t firstBlock = size_t(page) * blocksPerPage;
+        size_t lastBlock = std::min(firstBlock + blocksPerPage, pack->getBlocks().size());
+
+        std::vector<uint32_t> scratch;
+        if (!adjacency)
+        {
+            auto &first = pack->getBlocks()[firstBlock];
+            auto &last = pack->getBlocks()[lastBlock - 1];
+            scratch.resize(last.adjacencyBegin + last.numAdjacency - first.adjacencyBegin);
+            adjacency = scratch.data();
+        }
+        pack->decode(firstBlock, lastBlock, {positions, cells, sh, adjacency, hostPositions});
+        return;
+    }
+
+    auto &schema = ply->getSchema();
+    ply->convertVertexData(plyFile->data() + ply->getVertexDataOffset() + state.firstCell * schema.stride,
+                           state.numCells, static_cast<uint32_t>(state.adjacencyBegin), positions, cells, sh,
+                           hostPositions);
+    if (adjacency)
+        ply->convertAdjacencyData(plyFile->data() + ply->getAdjacencyDataOffset() +
+                                      state.adjacencyBegin * schema.adjacencyStride,
+                                  state.numAdjacency, adjacency);
+}
+
+void PagedScene::loadPage(uint32_t page, uint32_t slot)
+{
+    auto &state = pages[page];
+    auto staged = uploader->stage({
+        {positionPool.get(), size_t(slot) * cellsPerPage * sizeof(glm::vec4), state.numCells * sizeof(glm::vec4)},
+        {cellPool.get(), size_t(slot) * cellsPerPage * sizeof(RadFoamCell), state.numCells * sizeof(RadFoamCell)},
+        {shPool.get(), size_t(slot) * cellsPerPage * shBytesPerCell, state.numCells * shBytesPerCell},
+        {adjacencyPool.get(), size_t(slot) * adjacencyPerSlot * sizeof(uint32_t), state.numAdjacency * sizeof(uint32_t)},
+    });
+    // Adjacency ranges are rebased onto the slot, so the shader reads them without the page table.
+    // Cells are decoded on the host first because staging memory is write-combined.
+    cellScratch.resize(cellsPerPage);
+    if (shHalf)
+        shScratch.resize(size_t(cellsPerPage) * numShCoeffs);
+    decodePage(page, static_cast<glm::vec4 *>(staged[0]), cellScratch.data(),
+               shHalf ? shScratch.data() : static_cast<float *>(staged[2]), static_cast<uint32_t *>(staged[3]),
+               nullptr);
+    if (shHalf)
+        RadFoam::packShHalf(shScratch.data(), state.numCells, numShCoeffs, static_cast<uint32_t *>(staged[2]),
+                            numShCoeffs);
+    auto *cells = static_cast<RadFoamCell *>(staged[1]);
+    uint32_t base = slot * adjacencyPerSlot - static_cast<uint32_t>(state.adjacencyBegin);
+    for (uint32_t i = 0; i < state.numCells; ++i)
+        cells[i] = {cellScratch[i].density, cellScratch[i].adjacencyBegin + base, cellScratch[i].adjacencyEnd + base};
+    slotPages[slot] = page;
+}
+
+float PagedScene::distanceTo(uint32_t page, const glm::vec3 &pos) const
+{
+    auto &state = pages[page];
+    glm::vec3 d = glm::max(glm::max(state.boundsMin - pos, glm::vec3(0)), pos - state.boundsMax);
+    return glm::length(d);
+}
+
+std::vector<uint32_t> PagedScene::pagesByDistance(const glm::vec3 &pos) const
+{
+    std::vector<float> distances(pages.size());
+    for (uint32_t p = 0; p < pages.size(); ++p)
+        distances[p] = distanceTo(p, pos);
+
+    std::vector<uint32_t> order(pages.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return distances[a] < distances[b]; });
+    return order;
+}
+
+void PagedScene::prefetch(const glm::vec3 &pos)
+{
+    std::vector<uint32_t> loaded;
+    for (uint32_t page : pagesByDistance(pos))
+    {
+        auto freeSlot = std::find(slotPages.begin(), slotPages.end(), invalidSlot);
+        if (freeSlot == slotPages.end())
+            break;
+        if (pageEntries[page].slot != invalidSlot)
+            continue;
+        loadPage(page, static_cast<uint32_t>(freeSlot - slotPages.begin()));
+        loaded.push_back(page);
+    }
+    uploader->flush();
+
+    for (uint32_t slot = 0; slot < numSlots; ++slot)
+        if (slotPages[slot] != invalidSlot)
+            pageEntries[slotPages[slot]].slot = slot;
+    std::cout << std::format("Paged scene: prefetched {} pages\n", loaded.size());
+}
+
+void PagedScene::update(const glm::vec3 &pos, uint32_t frame)
+{
+    uint32_t numPages = getNumPages();
+    std::vector<uint32_t> requested;
+    for (uint32_t p = 0; p < numPages; ++p)
+    {
+        pages[p].lastUsed = std::max(pages[p].lastUsed, feedbackData[p]);
+        bool missing = pageEntries[p].slot == invalidSlot;
+        if (missing && (feedbackData[numPages + p] == frame || distanceTo(p, pos) == 0))
+            requested.push_back(p);
+    }
+    if (requested.empty())
+        return;
+
+    std::sort(requested.begin(), requested.end(), [&](uint32_t a, uint32_t b)
+              { return distanceTo(a, pos) < distanceTo(b, pos); });
+    if (requested.size() > maxUploadsPerFrame)
+        requested.resize(maxUploadsPerFrame);
+
+    std::vector<std::pair<uint32_t, uint32_t>> loaded;
+    for (uint32_t page : requested)
+    {
+        // Free slot first, otherwise the least recently used page that the last frame did not touch
+        uint32_t slot = invalidSlot;
+        uint32_t oldest = frame;
+        for (uint32_t s = 0; s < numSlots && oldest > 0; ++s)
+        {
+            uint32_t resident = slotPages[s];
+            uint32_t lastUsed = resident == invalidSlot ? 0 : pages[resident].lastUsed;
+            bool loadedThisFrame = std::any_of(loaded.begin(), loaded.end(), [s](auto &l)
+                                               { return l.second == s; });
+            if (!loadedThisFrame && (resident == invalidSlot || lastUsed < oldest))
+                slot = s, oldest = resident == invalidSlot ? 0 : lastUsed;
+        }
+        if (slot == invalidSlot)
+            break;
+
+        if (slotPages[slot] != invalidSlot)
+            pageEntries[slotPages[slot]].slot = invalidSlot;
+        loadPage(page, slot);
+        loaded.emplace_back(page, slot);
+    }
+    uploader->flush();
+
+    for (auto &[page, slot] : loaded)
+    {
+        pageEntries[page].slot = slot;
+        pages[page].lastUsed = frame;
+    }
+}
+
+uint32_t PagedScene::nearestCell(const glm::vec3 &pos)
+{
+    std::vector<glm::vec4> positionStream(cellsPerPage);
+    std::vector<RadFoamCell> cells(cellsPerPage);
+    std::vector<float> sh(size_t(cellsPerPage) * numShCoeffs);
+    std::vector<glm::vec3> positions(cellsPerPage);
+
+    // Pages in order of bound distance, until no closer cell can remain
+    float minDist = std::numeric_limits<float>::max();
+    uint32_t minIdx = 0;
+    for (uint32_t page : pagesByDistance(pos))
+    {
+        float boundDist = distanceTo(page, pos);
+        if (boundDist * boundDist >= minDist)
+            break;
+
+        decodePage(page, positionStream.data(), cells.data(), sh.data(), nullptr, positions.data());
+        for (uint32_t i = 0; i < pages[page].numCells; ++i)
+        {
+            glm::vec3 d = positions[i] - pos;
+            float dist = glm::dot(d, d);
+            if (dist < minDist)
+                minDist = dist, minIdx = static_cast<uint32_t>(pages[page].firstCell + i);
+        }
+    }
+    return minIdx;
+}
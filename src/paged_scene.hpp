@@ -0,0 +1,91 @@
+#pragma once
+#include "radfoam.hpp"
+#include "scene_pack.hpp"
+#include "streaming_loader.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Out-of-core scene: fixed-size pages of consecutive cells are streamed from a PLY or
+// .rfpack into a pool of GPU slots that fits a memory budget. The ray tracer looks pages
+// up in a page table and reports the pages it used or missed through a feedback buffer.
+class PagedScene
+{
+public:
+    static constexpr uint32_t cellsPerPage = 8 * ScenePack::cellsPerBlock;
+    static constexpr uint32_t invalidSlot = UINT32_MAX;
+    static constexpr uint32_t maxUploadsPerFrame = 4;
+
+    // Page table entry, read by ray_tracing.comp
+    struct Page
+    {
+        uint32_t slot;
+        uint32_t fallback; // Average color and opacity (unorm4x8), shown where the page is missing
+    };
+
+    // halfSh stores the SH pool as packed float16, see RadFoam::packShHalf
+    PagedScene(const std::string &path, size_t budgetBytes, bool halfSh = false);
+
+    // Fills the free slots with the pages closest to pos
+    void prefetch(const glm::vec3 &pos);
+    // Streams in the pages the given frame missed, closest first, evicting the least recently used
+    void update(const glm::vec3 &pos, uint32_t frame);
+    uint32_t nearestCell(const glm::vec3 &pos);
+
+    uint32_t getShDegree() const { return shDegree; }
+    bool isShHalf() const { return shHalf; }
+    uint32_t getNumPages() const { return static_cast<uint32_t>(pages.size()); }
+    auto getPositionPool() { return positionPool; }
+    auto getCellPool() { return cellPool; }
+    auto getShPool() { return shPool; }
+    auto getAdjacencyPool() { return adjacencyPool; }
+    auto getPageTable() { return pageTable; }
+    auto getFeedback() { return feedback; }
+
+private:
+    struct PageState
+    {
+        size_t firstCell;
+        size_t adjacencyBegin;
+        uint32_t numCells;
+        uint32_t numAdjacency;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        uint32_t lastUsed = 0;
+    };
+
+    void scanPages(std::vector<Page> &entries);
+    void decodePage(uint32_t page, glm::vec4 *positions, RadFoam::RadFoamCell *cells, float *sh,
+                    uint32_t *adjacency, glm::vec3 *hostPositions);
+    void loadPage(uint32_t page, uint32_t slot);
+    float distanceTo(uint32_t page, const glm::vec3 &pos) const;
+    std::vector<uint32_t> pagesByDistance(const glm::vec3 &pos) const;
+
+    std::unique_ptr<ScenePack> pack;
+    std::unique_ptr<RadFoamPly> ply;
+    std::unique_ptr<MappedFile> plyFile;
+
+    uint64_t numVertices;
+    uint64_t numAdjacency;
+    uint32_t shDegree;
+    uint32_t numShCoeffs;
+    bool shHalf = false;
+    size_t shBytesPerCell = 0;
+    uint32_t adjacencyPerSlot = 0;
+    uint32_t numSlots = 0;
+
+    std::vector<PageState> pages;
+    std::vector<uint32_t> slotPages; // Page held by every slot, or invalidSlot
+    Page *pageEntries = nullptr;     // Mapped page table
+    const uint32_t *feedbackData = nullptr; // usage[numPages] followed by requests[numPages]
+
+    std::shared_ptr<Buffer> positionPool;
+    std::shared_ptr<Buffer> cellPool;
+    std::shared_ptr<Buffer> shPool;
+    std::shared_ptr<Buffer> adjacencyPool;
+    std::shared_ptr<Buffer> pageTable;
+    std::shared_ptr<Buffer> feedback;
+    std::unique_ptr<StreamingUploader> uploader;
+    std::vector<RadFoam::RadFoamCell> cellScratch;
+    std::vector<float> shScratch; // float32 SH of a page before packing to float16
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Split [0, count) into contiguous ranges and run fn(begin, end) on each one in parallel
+template <typename Fn>
+void parallelFor(size_t count, Fn &&fn, size_t minRangeSize = 4096)
+{
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, (count + minRangeSize - 1) / std::max<size_t>(minRangeSize, 1));
+    if (numThreads <= 1)
+    {
+        if (count > 0)
+            fn(size_t(0), count);
+        return;
+    }
+
+    size_t rangeSize = (count + numThreads - 1) / numThreads;
+    std::vector<std::thread> workers;
+    for (size_t begin = rangeSize; begin < count; begin += rangeSize)
+        workers.emplace_back([&fn, begin, end = std::min(begin + rangeSize, count)]
+                             { fn(begin, end); });
+    fn(size_t(0), std::min(rangeSize, count));
+
+    for (auto &worker : workers)
+        worker.join();
+}
@@ -0,0 +1,118 @@
+#include "platform.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path)
+{
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open file: " + path);
+
+    LARGE_INTEGER size{};
+    GetFileSizeEx(fileHandle, &size);
+    fileSize = static_cast<size_t>(size.QuadPart);
+    if (fileSize == 0)
+        return;
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+        throw std::runtime_error("Failed to map file: " + path);
+
+    mappedData = static_cast<const char *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (mappedData == nullptr)
+        throw std::runtime_error("Failed to map file: " + path);
+}
+
+MappedFile::~MappedFile()
+{
+    if (mappedData)
+        UnmapViewOfFile(mappedData);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle && fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+}
+
+size_t getPeakResidentMemory()
+{
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+}
+
+size_t getCurrentResidentMemory()
+{
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path)
+{
+    fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        throw std::runtime_error("Failed to open file: " + path);
+
+    struct stat st{};
+    fstat(fileDescriptor, &st);
+    fileSize = static_cast<size_t>(st.st_size);
+    if (fileSize == 0)
+        return;
+
+    void *ptr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (ptr == MAP_FAILED)
+        throw std::runtime_error("Failed to map file: " + path);
+    madvise(ptr, fileSize, MADV_SEQUENTIAL);
+    mappedData = static_cast<const char *>(ptr);
+}
+
+MappedFile::~MappedFile()
+{
+    if (mappedData)
+        munmap(const_cast<char *>(mappedData), fileSize);
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+}
+
+size_t getPeakResidentMemory()
+{
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+size_t getCurrentResidentMemory()
+{
+    long pages = 0, residentPages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> residentPages;
+    return static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+#endif
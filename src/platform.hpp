@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return mappedData; }
+    size_t size() const { return fileSize; }
+
+private:
+    const char *mappedData = nullptr;
+    size_t fileSize = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+// Process memory statistics in bytes
+size_t getPeakResidentMemory();
+size_t getCurrentResidentMemory();
@@ -0,0 +1,180 @@
+#include "ply.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace
+{
+    const std::pair<const char *, PlyType> typeNames[] = {
+        {"char", PlyType::Int8}, {"int8", PlyType::Int8},
+        {"uchar", PlyType::UInt8}, {"uint8", PlyType::UInt8},
+        {"short", PlyType::Int16}, {"int16", PlyType::Int16},
+        {"ushort", PlyType::UInt16}, {"uint16", PlyType::UInt16},
+        {"int", PlyType::Int32}, {"int32", PlyType::Int32},
+        {"uint", PlyType::UInt32}, {"uint32", PlyType::UInt32},
+        {"int64", PlyType::Int64}, {"uint64", PlyType::UInt64},
+        {"float", PlyType::Float32}, {"float32", PlyType::Float32},
+        {"double", PlyType::Float64}, {"float64", PlyType::Float64},
+    };
+
+    PlyType parseType(const std::string &name)
+    {
+        for (auto &[typeName, type] : typeNames)
+            if (name == typeName)
+                return type;
+        throw std::runtime_error("PLY: unknown property type '" + name + "'");
+    }
+}
+
+size_t plyTypeSize(PlyType type)
+{
+    switch (type)
+    {
+    case PlyType::Int8:
+    case PlyType::UInt8: return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16: return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32: return 4;
+    case PlyType::Int64:
+    case PlyType::UInt64:
+    case PlyType::Float64: return 8;
+    }
+    return 0;
+}
+
+const char *plyTypeName(PlyType type)
+{
+    for (auto &[typeName, t] : typeNames)
+        if (t == type)
+            return typeName;
+    return "unknown";
+}
+
+const PlyProperty *PlyElement::findProperty(const std::string &propertyName) const
+{
+    for (auto &property : properties)
+        if (property.name == propertyName)
+            return &property;
+    return nullptr;
+}
+
+const PlyElement *PlyHeader::findElement(const std::string &elementName) const
+{
+    for (auto &element : elements)
+        if (element.name == elementName)
+            return &element;
+    return nullptr;
+}
+
+size_t PlyHeader::fileSize() const
+{
+    if (elements.empty())
+        return headerSize;
+    auto &last = elements.back();
+    return last.dataOffset + last.count * last.stride;
+}
+
+PlyHeader PlyHeader::parse(const char *data, size_t size)
+{
+    std::string_view content(data, size);
+    size_t end = content.find("end_header");
+    if (end == std::string_view::npos)
+        throw std::runtime_error("PLY: header not properly terminated");
+    end = content.find('\n', end);
+    if (end == std::string_view::npos)
+        throw std::runtime_error("PLY: header not properly terminated");
+
+    PlyHeader header;
+    header.headerSize = end + 1;
+
+    std::istringstream is{std::string(content.substr(0, header.headerSize))};
+    std::string line;
+    bool first = true;
+    while (std::getline(is, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+
+        if (first)
+        {
+            if (keyword != "ply")
+                throw std::runtime_error("PLY: invalid magic");
+            first = false;
+        }
+        else if (keyword == "format")
+        {
+            std::string format;
+            tokens >> format;
+            if (format != "binary_little_endian")
+                throw std::runtime_error("PLY: only binary little-endian format supported, got " + format);
+        }
+        else if (keyword == "element")
+        {
+            PlyElement element;
+            if (!(tokens >> element.name >> element.count))
+                throw std::runtime_error("PLY: malformed line '" + line + "'");
+            header.elements.push_back(std::move(element));
+        }
+        else if (keyword == "property")
+        {
+            if (header.elements.empty())
+                throw std::runtime_error("PLY: property outside of an element");
+
+            std::string typeName, name;
+            tokens >> typeName;
+            if (typeName == "list")
+                throw std::runtime_error("PLY: list properties are not supported");
+            if (!(tokens >> name))
+                throw std::runtime_error("PLY: malformed line '" + line + "'");
+
+            auto &element = header.elements.back();
+            PlyType type = parseType(typeName);
+            element.properties.push_back({name, type, element.stride});
+            element.stride += plyTypeSize(type);
+        }
+        else if (keyword == "end_header")
+            break;
+        // comment / obj_info lines are ignored
+    }
+
+    size_t offset = header.headerSize;
+    for (auto &element : header.elements)
+    {
+        element.dataOffset = offset;
+        offset += element.count * element.stride;
+    }
+    return header;
+}
+
+PlyHeader PlyHeader::read(const std::string &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error("Failed to open PLY file: " + path);
+
+    // Grow the read until the terminated end_header line is in memory
+    constexpr size_t step = 64 * 1024;
+    std::string content;
+    for (;;)
+    {
+        size_t end = content.find("end_header");
+        if (end != std::string::npos && content.find('\n', end) != std::string::npos)
+            break;
+
+        size_t size = content.size();
+        content.resize(size + step);
+        ifs.read(content.data() + size, step);
+        content.resize(size + ifs.gcount());
+        if (ifs.gcount() == 0)
+            break;
+    }
+    return parse(content.data(), content.size());
+}
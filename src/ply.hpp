@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum class PlyType : uint8_t
+{
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Int64, // Not in the PLY specification, written by numpy-based exporters for 64-bit offsets
+    UInt64,
+    Float32,
+    Float64
+};
+
+size_t plyTypeSize(PlyType type);
+const char *plyTypeName(PlyType type);
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;
+    size_t offset; // Byte offset inside one record
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count = 0;
+    size_t stride = 0;     // Bytes per record
+    size_t dataOffset = 0; // Byte offset of the first record in the file
+    std::vector<PlyProperty> properties;
+
+    const PlyProperty *findProperty(const std::string &propertyName) const;
+};
+
+// Property table of a binary little-endian PLY header
+struct PlyHeader
+{
+    std::vector<PlyElement> elements;
+    size_t headerSize = 0;
+
+    static PlyHeader parse(const char *data, size_t size);
+    static PlyHeader read(const std::string &path);
+    const PlyElement *findElement(const std::string &elementName) const;
+    size_t fileSize() const;
+};
+
+// Read one scalar of any PLY type and convert it to T
+template <typename T>
+T readPlyValue(const char *src, PlyType type)
+{
+    auto load = [src]<typename S>(S) -> T
+    {
+        S value;
+        std::memcpy(&value, src, sizeof(S));
+        return static_cast<T>(value);
+    };
+
+    switch (type)
+    {
+    case PlyType::Int8: return load(int8_t{});
+    case PlyType::UInt8: return load(uint8_t{});
+    case PlyType::Int16: return load(int16_t{});
+    case PlyType::UInt16: return load(uint16_t{});
+    case PlyType::Int32: return load(int32_t{});
+    case PlyType::UInt32: return load(uint32_t{});
+    case PlyType::Int64: return load(int64_t{});
+    case PlyType::UInt64: return load(uint64_t{});
+    case PlyType::Float32: return load(float{});
+    case PlyType::Float64: return load(double{});
+    }
+    return T{};
+}
@@ -0,0 +1,71 @@
+#include "quality_tier.hpp"
+#include "foam_lod.hpp"
+#include <algorithm>
+#include <bit>
+
+QualityTier::Choice QualityTier::project(const Counts &counts, bool halfSh, uint32_t shDegree, bool facePlanes)
+{
+    uint64_t numCells = counts.numCells + counts.numCoarseCells;
+    uint64_t numAdjacency = counts.numAdjacency + counts.numCoarseAdjacency;
+    auto streams = [](uint64_t cells, uint64_t adjacency, size_t shCellSize)
+    {
+        return cells * (sizeof(glm::vec4) + sizeof(RadFoam::RadFoamCell) + shCellSize) + adjacency * sizeof(uint32_t);
+    };
+    // As buildFacePlanes sizes them: one plane per entry of the adjacency buffer, coarse entries included
+    size_t planeSize = numAdjacency * sizeof(glm::vec4);
+    size_t nodeSize = counts.numCoarseCells ? numCells * sizeof(FoamLod::Node) : 0;
+    // Morton keys, values and their ping-pong copies, and the GPU tree, freed once the tree is downloaded
+    int numLevels = counts.numCells > 1 ? std::bit_width(counts.numCells - 1) : 1;
+    size_t treeBuildSize = 4 * counts.numCells * sizeof(uint32_t) + (sizeof(AABBTree::AABB) << numLevels);
+
+    uint32_t numCoeffs = 3 * (shDegree + 1) * (shDegree + 1);
+    size_t shCellSize = halfSh ? RadFoam::getShHalfWords(numCoeffs) * sizeof(uint32_t) : numCoeffs * sizeof(float);
+    size_t fine = streams(counts.numCells, counts.numAdjacency, shCellSize);
+    size_t all = streams(numCells, numAdjacency, shCellSize);
+    Choice choice{halfSh, shDegree, facePlanes};
+    choice.footprint = all + nodeSize + (facePlanes ? planeSize : 0);
+    // The tree is built on the fine streams; the LOD then copies them into extended buffers
+    choice.peak = std::max(choice.footprint, fine + treeBuildSize);
+    if (counts.numCoarseCells)
+        choice.peak = std::max(choice.peak, fine + all);
+    return choice;
+}
+
+std::vector<QualityTier::Choice> QualityTier::getCandidates(const Counts &counts)
+{
+    // Face planes only speed up traversal, so they go before any SH precision or band is given up
+    std::vector<Choice> candidates;
+    candidates.push_back(project(counts, false, counts.shDegree, true));
+    candidates.push_back(project(counts, false, counts.shDegree, false));
+    candidates.push_back(project(counts, true, counts.shDegree, false));
+    for (uint32_t d = counts.shDegree; d-- > 0;)
+        candidates.push_back(project(counts, true, d, false));
+    return candidates;
+}
+
+QualityTier::Choice QualityTier::choose(const Counts &counts)
+{
+    // Loading may start on a worker thread before the window and device are up
+    VulkanContext::getContext().waitForDevice();
+    size_t free = VulkanContext::getContext().getAvailableDeviceMemory();
+    size_t available = static_cast<size_t>(free * (1.0 - headroom));
+
+    auto candidates = getCandidates(counts);
+    auto chosen = std::find_if(candidates.begin(), candidates.end(), [available](const Choice &choice)
+                               { return choice.peak <= available; });
+    bool fits = chosen != candidates.end();
+    if (!fits)
+        chosen = std::prev(candidates.end());
+
+    std::cout << std::format("Quality tier: {}MB available to the scene ({}MB free), {} cells{}\n",
+                             available >> 20, free >> 20, counts.numCells,
+                             counts.numCoarseCells ? std::format(" and {} coarse cells", counts.numCoarseCells) : "");
+    for (auto it = candidates.begin(); it != candidates.end(); ++it)
+        std::cout << std::format("  {} {} SH degree {}, {}: {}MB, peak {}MB\n",
+                                 it == chosen ? "*" : " ", it->halfSh ? "float16" : "float32", it->shDegree,
+                                 it->facePlanes ? "face planes" : "no face planes", it->footprint >> 20,
+                                 it->peak >> 20);
+    if (!fits)
+        std::cout << "Warning: no quality tier fits the device memory budget, using the leanest\n";
+    return *chosen;
+}
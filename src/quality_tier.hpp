@@ -0,0 +1,41 @@
+#pragma once
+#include "radfoam.hpp"
+#include <cstdint>
+#include <vector>
+
+// Richest scene representation that fits the device memory left, projected from the counts of the
+// scene header before anything is uploaded. Tiers run from float32 SH with face planes, through
+// float32 then float16 SH without planes, down to float16 SH truncated to lower degrees.
+class QualityTier
+{
+public:
+    // Scene header counts; the coarse ones are zero without a LOD hierarchy
+    struct Counts
+    {
+        uint64_t numCells;
+        uint64_t numAdjacency;
+        uint32_t shDegree;
+        uint64_t numCoarseCells;
+        uint64_t numCoarseAdjacency;
+    };
+
+    struct Choice
+    {
+        bool halfSh;
+        uint32_t shDegree;
+        bool facePlanes;
+        size_t footprint; // Device memory of the scene once loaded
+        size_t peak;      // Including the AABB tree build and the LOD copies
+    };
+
+    // Share of the free device memory left for other allocations
+    static constexpr double headroom = 0.1;
+
+    // Device memory of the scene in the given representation
+    static Choice project(const Counts &counts, bool halfSh, uint32_t shDegree, bool facePlanes);
+    // From richest to leanest
+    static std::vector<Choice> getCandidates(const Counts &counts);
+    // Prints every candidate's projected footprint and returns the first whose peak fits,
+    // or the leanest with a warning
+    static Choice choose(const Counts &counts);
+};
@@ -1,116 +1,1293 @@
 #include "RadFoam.hpp"
+#include "parallel.hpp"
+#include "streaming_loader.hpp"
+#include "scene_pack.hpp"
+#include <glm/gtc/packing.hpp>
 #include <stdexcept>
 #include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <queue>
 #include <functional>
+#include <limits>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 
-#pragma pack(push, 1)
-struct RawVertex
+namespace
 {
-    float x, y, z;
-    float density;
-    uint32_t adjacency_offset;
-    float sh_coeffs[48];
-};
+    using DecodeFn = void (*)(const RadFoamPly::VertexSchema &schema, const char *src,
+                              size_t begin, size_t end, uint32_t adjacencyBegin, glm::vec4 *positionDst,
+                              RadFoam::RadFoamCell *cellDst, float *shDst, glm::vec3 *hostPositions);
 
-#pragma pack(pop)
+    template <bool Packed>
+    uint32_t readAdjacencyEnd(const RadFoamPly::VertexSchema &schema, const char *record)
+    {
+        if constexpr (Packed)
+        {
+            uint32_t offset;
+            std::memcpy(&offset, record + schema.offset.offset, sizeof(uint32_t));
+            return offset;
+        }
+        else
+            return static_cast<uint32_t>(readPlyValue<uint64_t>(record + schema.offset.offset, schema.offset.type));
+    }
+
+    // Per-vertex copy specialized on the SH coefficient count and on whether the record
+    // stores everything as contiguous 32-bit fields
+    template <uint32_t NumCoeffs, bool Packed>
+    void decodeVertices(const RadFoamPly::VertexSchema &schema, const char *src,
+                        size_t begin, size_t end, uint32_t adjacencyBegin, glm::vec4 *positionDst,
+                        RadFoam::RadFoamCell *cellDst, float *shDst, glm::vec3 *hostPositions)
+    {
+        // The PLY stores the end of every cell's neighbours; the begin is the previous record's end
+        uint32_t previousEnd = begin ? readAdjacencyEnd<Packed>(schema, src + (begin - 1) * schema.stride)
+                                     : adjacencyBegin;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const char *record = src + i * schema.stride;
+            glm::vec3 pos;
+            RadFoam::RadFoamCell cell{};
+            float sh[NumCoeffs];
 
-void RadFoam::parseHeader(std::istream &is)
+            if constexpr (Packed)
+            {
+                std::memcpy(&pos, record + schema.x.offset, 3 * sizeof(float));
+                std::memcpy(&cell.density, record + schema.density.offset, sizeof(float));
+                std::memcpy(sh, record + schema.sh[0].offset, sizeof(sh));
+            }
+            else
+            {
+                pos = glm::vec3(readPlyValue<float>(record + schema.x.offset, schema.x.type),
+                                readPlyValue<float>(record + schema.y.offset, schema.y.type),
+                                readPlyValue<float>(record + schema.z.offset, schema.z.type));
+                cell.density = readPlyValue<float>(record + schema.density.offset, schema.density.type);
+                for (uint32_t c = 0; c < NumCoeffs; ++c)
+                    sh[c] = readPlyValue<float>(record + schema.sh[c].offset, schema.sh[c].type);
+                // Invert the viewer's DC term (SH_C0 * dc + 0.5) from the stored 8-bit color
+                if (schema.colorDc)
+                    for (uint32_t c = 0; c < 3; ++c)
+                        sh[c] = (sh[c] / 255.0f - 0.5f) / 0.28209479177387814f;
+            }
+            cell.adjacencyBegin = previousEnd;
+            cell.adjacencyEnd = previousEnd = readAdjacencyEnd<Packed>(schema, record);
+
+            positionDst[i] = glm::vec4(pos, 0);
+            cellDst[i] = cell;
+            std::memcpy(shDst + i * NumCoeffs, sh, sizeof(sh));
+            if (hostPositions)
+                hostPositions[i] = pos;
+        }
+    }
+
+    template <uint32_t NumCoeffs>
+    DecodeFn selectDecoder(bool packed)
+    {
+        return packed ? decodeVertices<NumCoeffs, true> : decodeVertices<NumCoeffs, false>;
+    }
+}
+
+RadFoamPly::RadFoamPly(const std::string &path, bool planarSh) : path(path)
 {
-    std::string line;
+    auto header = PlyHeader::read(path);
+    if (header.fileSize() > std::filesystem::file_size(path))
+        throw std::runtime_error("PLY file truncated: " + path);
 
-    std::getline(is, line);
-    assert(line == "ply" && "Invalid PLY file");
+    auto vertexElement = header.findElement("vertex");
+    auto adjacencyElement = header.findElement("adjacency");
+    if (!vertexElement)
+        throw std::runtime_error("PLY: missing vertex element");
+    if (!adjacencyElement)
+        throw std::runtime_error("PLY: missing adjacency element");
 
-    std::getline(is, line);
-    assert(line.find("binary_little_endian") != std::string::npos &&
-           "Only binary little-endian format supported");
+    auto require = [](const PlyElement *element, const std::string &name)
+    {
+        auto property = element->findProperty(name);
+        if (!property)
+            throw std::runtime_error("PLY: missing property '" + name + "' in element " + element->name);
+        return *property;
+    };
 
-    std::getline(is, line);
-    int vertexScanResult = sscanf(line.c_str(), "element vertex %u", &numVertices);
-    assert(vertexScanResult == 1 && "Missing vertex element");
+    schema.stride = vertexElement->stride;
+    schema.x = require(vertexElement, "x");
+    schema.y = require(vertexElement, "y");
+    schema.z = require(vertexElement, "z");
+    schema.density = require(vertexElement, "density");
+    schema.offset = require(vertexElement, "adjacency_offset");
+    schema.adjacency = require(adjacencyElement, "adjacency");
+    schema.adjacencyStride = adjacencyElement->stride;
 
-    for (int i = 0; i < 53; ++i)
-        assert(std::getline(is, line) && "Unexpected end of header");
+    std::vector<PlyProperty> coefficients;
+    while (auto property = vertexElement->findProperty("color_sh_" + std::to_string(coefficients.size())))
+        coefficients.push_back(*property);
 
-    std::getline(is, line);
-    int adjScanResult = sscanf(line.c_str(), "element adjacency %u", &numAdjacency);
-    assert(adjScanResult == 1 && "Missing adjacency element");
+    auto isBasis = [](size_t count)
+    {
+        for (uint32_t degree = 0; degree <= 3; ++degree)
+            if (count == 3 * (degree + 1) * (degree + 1))
+                return true;
+        return false;
+    };
 
-    std::getline(is, line);
-    assert(line == "property uint adjacency" && "Invalid adjacency property");
+    // RadFoam's own export stores the DC term as an 8-bit color and only the higher bands as color_sh_N
+    auto red = vertexElement->findProperty("red");
+    auto green = vertexElement->findProperty("green");
+    auto blue = vertexElement->findProperty("blue");
+    schema.colorDc = !isBasis(coefficients.size()) && isBasis(coefficients.size() + 3) && red && green && blue;
 
-    std::getline(is, line);
-    assert(line == "end_header" && "Header not properly terminated");
-}
+    if (planarSh)
+    {
+        size_t perChannel = coefficients.size() / 3;
+        std::vector<PlyProperty> interleaved(coefficients.size());
+        for (size_t channel = 0; channel < 3; ++channel)
+            for (size_t k = 0; k < perChannel; ++k)
+                interleaved[k * 3 + channel] = coefficients[channel * perChannel + k];
+        coefficients = std::move(interleaved);
+    }
 
-void RadFoam::parseVertexData(std::istream &is)
-{
-    vertices.resize(numVertices);
+    schema.sh.clear();
+    if (schema.colorDc)
+        schema.sh = {*red, *green, *blue};
+    schema.sh.insert(schema.sh.end(), coefficients.begin(), coefficients.end());
+
+    numShCoeffs = static_cast<uint32_t>(schema.sh.size());
+    shDegree = 0;
+    while (shDegree < 3 && 3 * (shDegree + 1) * (shDegree + 1) < numShCoeffs)
+        shDegree++;
+    if (numShCoeffs != 3 * (shDegree + 1) * (shDegree + 1))
+        throw std::runtime_error("PLY: " + std::to_string(numShCoeffs) +
+                                 " SH coefficients do not form an RGB SH basis of degree 0-3");
 
-    std::vector<RawVertex> rawVertices(numVertices);
-    is.read(reinterpret_cast<char *>(rawVertices.data()),
-            numVertices * sizeof(RawVertex));
+    auto isFloat = [](const PlyProperty &p)
+    { return p.type == PlyType::Float32; };
+    auto isWord = [](const PlyProperty &p)
+    { return p.type == PlyType::UInt32 || p.type == PlyType::Int32; };
 
-    assert((is.gcount() == numVertices * sizeof(RawVertex)) &&
-           "Vertex data incomplete");
+    schema.packed = !schema.colorDc && isFloat(schema.x) && isFloat(schema.y) && isFloat(schema.z) &&
+                    schema.y.offset == schema.x.offset + 4 && schema.z.offset == schema.y.offset + 4 &&
+                    isFloat(schema.density) && isWord(schema.offset);
+    for (uint32_t c = 0; c < numShCoeffs; ++c)
+        schema.packed = schema.packed && isFloat(schema.sh[c]) &&
+                        schema.sh[c].offset == schema.sh[0].offset + c * sizeof(float);
+
+    numVertices = vertexElement->count;
+    numAdjacency = adjacencyElement->count;
+    vertexDataOffset = vertexElement->dataOffset;
+    adjacencyDataOffset = adjacencyElement->dataOffset;
+
+    std::cout << std::format("PLY schema: {} vertices ({} bytes each), {} adjacency, SH degree {}{}, {} decoder\n",
+                             numVertices, schema.stride, numAdjacency, shDegree,
+                             schema.colorDc ? " (DC from color)" : "", schema.packed ? "packed" : "generic");
+}
 
-    for (size_t i = 0; i < numVertices; ++i)
+void RadFoamPly::convertVertexData(const char *src, size_t count, uint32_t adjacencyBegin, glm::vec4 *positionDst,
+                                   RadFoam::RadFoamCell *cellDst, float *shDst, glm::vec3 *hostPositionDst) const
+{
+    DecodeFn decode = nullptr;
+    switch (shDegree)
     {
-        auto &src = rawVertices[i];
-        auto &dst = vertices[i];
-        dst.pos = glm::vec4(src.x, src.y, src.z, 0);
-        dst.offset = src.adjacency_offset;
-        dst.density = src.density;
-        std::copy_n(src.sh_coeffs, 48, dst.sh_coeffs.begin());
+    case 0: decode = selectDecoder<3>(schema.packed); break;
+    case 1: decode = selectDecoder<12>(schema.packed); break;
+    case 2: decode = selectDecoder<27>(schema.packed); break;
+    case 3: decode = selectDecoder<48>(schema.packed); break;
     }
+
+    parallelFor(count, [&](size_t begin, size_t end)
+                { decode(schema, src, begin, end, adjacencyBegin, positionDst, cellDst, shDst, hostPositionDst); });
+}
+
+uint32_t RadFoamPly::getAdjacencyEnd(const char *record) const
+{
+    return schema.packed ? readAdjacencyEnd<true>(schema, record) : readAdjacencyEnd<false>(schema, record);
 }
 
-void RadFoam::parseAdjacencyData(std::istream &is)
+void RadFoamPly::convertAdjacencyData(const char *src, size_t count, uint32_t *dst) const
 {
-    adjacency.resize(numAdjacency);
-    is.read(reinterpret_cast<char *>(adjacency.data()),
-            numAdjacency * sizeof(uint32_t));
+    if (schema.adjacencyStride == sizeof(uint32_t) &&
+        (schema.adjacency.type == PlyType::UInt32 || schema.adjacency.type == PlyType::Int32))
+    {
+        std::memcpy(dst, src, count * sizeof(uint32_t));
+        return;
+    }
 
-    assert((is.gcount() == numAdjacency * sizeof(uint32_t)) && "Adjacency data incomplete");
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+            dst[i] = readPlyValue<uint32_t>(src + i * schema.adjacencyStride + schema.adjacency.offset,
+                                            schema.adjacency.type); });
 }
 
-RadFoam::RadFoam(std::shared_ptr<RadFoamVulkanArgs> pArgs)
+RadFoam::RadFoam(std::shared_ptr<RadFoamVulkanArgs> pArgs, ShFormatChooser chooseShFormat)
+    : chooseShFormat(std::move(chooseShFormat))
 {
     auto startTime = std::chrono::high_resolution_clock::now();
 
-    std::ifstream ifs(pArgs->scenePath, std::ios::binary);
-    assert(ifs && ("Failed to open PLY file."));
+    bool fromPack = ScenePack::isPackPath(pArgs->scenePath);
+    if (fromPack)
+    {
+        loadFromPack(pArgs->scenePath);
+    }
+    else
+    {
+        pCache = SceneCache::open(*pArgs);
+        if (pCache && !loadFromCache(*pCache))
+        {
+            std::cout << std::format("Scene cache {} ignored: content hash mismatch\n", pCache->getFilePath());
+            pCache.reset();
+        }
+    }
 
-    parseHeader(ifs);
-    parseVertexData(ifs);
-    parseAdjacencyData(ifs);
-    uploadRadFoam();
+    if (!fromPack && !pCache)
+        uploadRadFoam(RadFoamPly(pArgs->scenePath));
+    if (numAdjacency > UINT32_MAX)
+        findAdjacencyWraps();
+    // It may refer to the caller's state
+    this->chooseShFormat = nullptr;
 
     auto endTime = std::chrono::high_resolution_clock::now();
-    std::cout << "Loading RadFoam Scene: "
+    std::cout << "Loading RadFoam Scene" << (pCache ? " from cache: " : fromPack ? " from pack: " : ": ")
               << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
-              << "ms" << std::endl;
+              << "ms, peak RSS " << (getPeakResidentMemory() >> 20) << "MB" << std::endl;
+}
+
+glm::vec3 RadFoam::getPosition(uint32_t index) const
+{
+    if (!quantizedPositions.empty())
+        return positionBoundsMin + glm::vec3(quantizedPositions[index]) * positionScale;
+    return positions[index];
+}
+
+void RadFoam::compactHostData(bool quantize)
+{
+    if (quantize && !positions.empty())
+    {
+        glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+        positionBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        for (auto &p : positions)
+        {
+            positionBoundsMin = glm::min(positionBoundsMin, p);
+            boundsMax = glm::max(boundsMax, p);
+        }
+        positionScale = (boundsMax - positionBoundsMin) / 65535.0f;
+        glm::vec3 inverseScale = glm::vec3(1.0f) / glm::max(positionScale, glm::vec3(1e-30f));
+
+        quantizedPositions.resize(positions.size());
+        parallelFor(positions.size(), [&](size_t begin, size_t end)
+                    {
+            for (size_t i = begin; i < end; ++i)
+                quantizedPositions[i] = glm::u16vec3(glm::round((positions[i] - positionBoundsMin) * inverseScale)); });
+        std::vector<glm::vec3>().swap(positions);
+    }
+    positions.shrink_to_fit();
+    pCache.reset();
+}
+
+size_t RadFoam::getHostDataSize() const
+{
+    return positions.capacity() * sizeof(glm::vec3) + quantizedPositions.capacity() * sizeof(glm::u16vec3);
+}
+
+size_t RadFoam::getDeviceMemorySize() const
+{
+    size_t total = 0;
+    for (auto &buffer : {positionBuffer, positionBlockBuffer, floatPositionBuffer, cellBuffer, shBuffer, floatShBuffer,
+                         shIndexBuffer, adjacencyBuffer, facePlaneBuffer, paddedAdjacencyBuffer, deltaOverflowBuffer,
+                         faceCellBuffer, csrCellBuffer, csrAdjacencyBuffer})
+        if (buffer)
+            total += buffer->getAllocationSize();
+    return total;
+}
+
+uint32_t RadFoam::nearestPosition(const glm::vec3 &pos) const
+{
+    std::mutex mutex;
+    float minDist = std::numeric_limits<float>::max();
+    uint32_t minIdx = 0;
+    parallelFor(numVertices, [&](size_t begin, size_t end)
+                {
+        float localDist = std::numeric_limits<float>::max();
+        uint32_t localIdx = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::vec3 d = getPosition(static_cast<uint32_t>(i)) - pos;
+            float dist = glm::dot(d, d);
+            if (dist < localDist)
+                localDist = dist, localIdx = static_cast<uint32_t>(i);
+        }
+        std::lock_guard lock(mutex);
+        if (localDist < minDist || (localDist == minDist && localIdx < minIdx))
+            minDist = localDist, minIdx = localIdx; }, 1 << 16);
+    return minIdx;
+}
+
+void RadFoam::packShHalf(const float *src, size_t count, uint32_t numShCoeffs, uint32_t *dst, uint32_t srcStride)
+{
+    uint32_t wordsPerCell = getShHalfWords(numShCoeffs);
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const float *cellSh = src + i * srcStride;
+            uint32_t *cellDst = dst + i * wordsPerCell;
+            for (uint32_t w = 0; w < wordsPerCell; ++w)
+            {
+                float hi = (2 * w + 1 < numShCoeffs) ? cellSh[2 * w + 1] : 0.0f;
+                cellDst[w] = glm::packHalf2x16(glm::vec2(cellSh[2 * w], hi));
+            }
+        } });
 }
 
-void RadFoam::uploadRadFoam()
+void RadFoam::unpackShHalf(const uint32_t *src, size_t count, uint32_t numShCoeffs, float *dst)
 {
+    uint32_t wordsPerCell = getShHalfWords(numShCoeffs);
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+            for (uint32_t c = 0; c < numShCoeffs; ++c)
+            {
+                glm::vec2 pair = glm::unpackHalf2x16(src[i * wordsPerCell + c / 2]);
+                dst[i * numShCoeffs + c] = pair[c % 2];
+            } });
+}
+
+void RadFoam::convertShToHalf(bool keepFloat)
+{
+    if (shHalf)
+        return;
+    if (shIndexBuffer)
+        throw std::runtime_error("Variable-length SH stays float32");
+
+    size_t numCells = getNumStoredCells();
+    uint32_t wordsPerCell = getShHalfWords(numShCoeffs);
+    auto halfBuffer = std::make_shared<Buffer>(std::max<size_t>(numCells * wordsPerCell, 1) * sizeof(uint32_t),
+                                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                               VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
     auto &context = VulkanContext::getContext();
-    const size_t vertexBufferSize = sizeof(RadFoamVertex) * vertices.size();
-    const size_t adjacencyBufferSize = sizeof(uint32_t) * adjacency.size();
+    auto shader = std::make_shared<Shader>("src/shader/spv/sh_to_half.comp.spv");
+    std::vector<DescriptorSet::BindingInfo> bindings = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // float32 SH
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // float16 SH
+    };
+    auto set = std::make_shared<DescriptorSet>(bindings);
+
+    struct
+    {
+        uint32_t numWords;
+        uint32_t numCoeffs;
+        uint32_t wordsPerCell;
+    } cons{0, numShCoeffs, wordsPerCell};
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
+    std::vector<VkPushConstantRange> pushConstants{
+        {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cons)}};
+    auto pipeline = std::make_shared<ComputePipeline>(
+        shader->shaderModule, descriptorSetLayouts, pushConstants);
+    pipeline->addDescriptorSet(set);
 
-    vertexBuffer = std::make_shared<Buffer>(vertexBufferSize,
-                                            VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    // Passes over power-of-two cell ranges keep the float32 binding within maxStorageBufferRange
+    size_t cellsPerPass = size_t(1) << 30;
+    while (cellsPerPass > 256 && cellsPerPass * numShCoeffs * sizeof(float) > getMaxBindingRange())
+        cellsPerPass >>= 1;
+    for (size_t first = 0; first < numCells; first += cellsPerPass)
+    {
+        size_t count = std::min(cellsPerPass, numCells - first);
+        set->bindBuffers(0, {shBuffer->getBuffer()}, first * numShCoeffs * sizeof(float),
+                         count * numShCoeffs * sizeof(float));
+        set->bindBuffers(1, {halfBuffer->getBuffer()}, first * wordsPerCell * sizeof(uint32_t),
+                         count * wordsPerCell * sizeof(uint32_t));
+        cons.numWords = static_cast<uint32_t>(count * wordsPerCell);
 
-    vertexBuffer->uploadData(vertices.data(), vertexBufferSize);
+        auto cmd = context.beginSingleTimeCommands();
+        pipeline->bindDescriptorSets(cmd);
+        pipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+        auto workGroups = std::min<size_t>((size_t(cons.numWords) + 255) / 256, 65535);
+        vkCmdDispatch(cmd, static_cast<uint32_t>(std::max<size_t>(workGroups, 1)), 1, 1);
+        context.endSingleTimeCommands(cmd);
+    }
 
-    adjacencyBuffer = std::make_shared<Buffer>(adjacencyBufferSize,
-                                               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    std::cout << std::format("Half-precision SH: {}MB -> {}MB\n", shBuffer->getSize() >> 20,
+                             halfBuffer->getSize() >> 20);
+    if (keepFloat)
+        floatShBuffer = shBuffer;
+    shBuffer = halfBuffer;
+    shHalf = true;
+}
+
+void RadFoam::packVariableSh(float bandEnergy, float minDensity, bool keepFloat)
+{
+    if (shIndexBuffer)
+        return;
+    if (shHalf)
+        throw std::runtime_error("Variable-length SH is packed from float32 SH, not float16");
+
+    size_t numCells = getNumStoredCells();
+    std::vector<RadFoamCell> cells(numCells);
+    cellBuffer->downloadData(cells.data(), cells.size() * sizeof(RadFoamCell));
+
+    auto classify = [&](const float *sh, float density)
+    {
+        // Cells that are never seen, or too faint to matter, store nothing and are rendered as empty
+        if (density <= 0.0f || density <= minDensity)
+            return noShStorage;
+        uint32_t degree = 0;
+        for (uint32_t band = 1; band <= shDegree; ++band)
+        {
+            float energy = 0.0f;
+            for (uint32_t c = 3 * band * band; c < 3 * (band + 1) * (band + 1); ++c)
+                energy += sh[c] * sh[c];
+            if (energy > bandEnergy)
+                degree = band;
+        }
+        return degree;
+    };
+
+    // Classified in parallel per batch, packed in cell order
+    constexpr size_t cellsPerBatch = 1 << 18;
+    std::vector<float> batch, packed;
+    std::vector<uint32_t> degrees, index(numCells);
+    size_t numClass[noShStorage + 1] = {};
+    for (size_t first = 0; first < numCells; first += cellsPerBatch)
+    {
+        size_t count = std::min(cellsPerBatch, numCells - first);
+        batch.resize(count * numShCoeffs);
+        degrees.resize(count);
+        shBuffer->downloadData(batch.data(), batch.size() * sizeof(float), first * numShCoeffs * sizeof(float));
+        parallelFor(count, [&](size_t begin, size_t end)
+                    {
+            for (size_t i = begin; i < end; ++i)
+                degrees[i] = classify(batch.data() + i * numShCoeffs, cells[first + i].density); });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t degree = degrees[i];
+            numClass[degree]++;
+            if (degree == noShStorage)
+            {
+                index[first + i] = noShStorage;
+                continue;
+            }
+            if (packed.size() >= size_t(1) << 29)
+                throw std::runtime_error("Variable-length SH: offsets exceed 29 bits");
+            index[first + i] = static_cast<uint32_t>(packed.size() << 3) | degree;
+            const float *sh = batch.data() + i * numShCoeffs;
+            packed.insert(packed.end(), sh, sh + 3 * (degree + 1) * (degree + 1));
+        }
+    }
+
+    auto packedBuffer = createDeviceBuffer(packed.data(), packed.size() * sizeof(float));
+    shIndexBuffer = createDeviceBuffer(index.data(), index.size() * sizeof(uint32_t));
+
+    std::cout << std::format("Variable-length SH: cells of degree 3/2/1/0/none {}/{}/{}/{}/{}, {}MB -> {}MB\n",
+                             numClass[3], numClass[2], numClass[1], numClass[0], numClass[noShStorage],
+                             shBuffer->getSize() >> 20, (packedBuffer->getSize() + shIndexBuffer->getSize()) >> 20);
+    if (keepFloat)
+        floatShBuffer = shBuffer;
+    shBuffer = packedBuffer;
+}
+
+void RadFoam::buildFacePlanes()
+{
+    if (faceCellBuffer)
+        return;
+    if (deltaOverflowBuffer)
+        throw std::runtime_error("Face planes read 32-bit adjacency, build them before the delta encoding");
+    if (positionBits)
+        throw std::runtime_error("Face planes need float32 positions, build them before quantizing");
+    requireAdjacency32("Face planes");
+
+    size_t numCells = getNumStoredCells();
+    size_t numFaces = adjacencyBuffer->getSize() / sizeof(uint32_t);
+    checkBindingRange(positionBuffer, "Face planes: positions");
+    checkBindingRange(cellBuffer, "Face planes: cells");
+
+    // Passes over cell ranges whose adjacency entries and planes fit one binding, bound from a
+    // multiple of 64 entries to keep the offsets aligned; a single pass unless the planes exceed it
+    struct Pass
+    {
+        size_t firstCell, numCells, firstEntry, numEntries;
+    };
+    std::vector<Pass> passes;
+    size_t maxEntries = getMaxBindingRange() / sizeof(glm::vec4) & ~size_t(63);
+    if (numFaces <= maxEntries)
+        passes.push_back({0, numCells, 0, numFaces});
+    else
+    {
+        std::vector<RadFoamCell> cells(numCells);
+        cellBuffer->downloadData(cells.data(), cells.size() * sizeof(RadFoamCell));
+        for (size_t first = 0, last = 0; first < numCells; first = last)
+        {
+            size_t base = cells[first].adjacencyBegin & ~size_t(63), end = base;
+            for (; last < numCells && cells[last].adjacencyBegin >= base &&
+                   std::max<size_t>(end, cells[last].adjacencyEnd) - base <= maxEntries;
+                 ++last)
+                end = std::max<size_t>(end, cells[last].adjacencyEnd);
+            if (last == first)
+                throw std::runtime_error(std::format("Face planes: cell {} has more neighbours than one binding holds", first));
+            passes.push_back({first, last - first, base, end - base});
+        }
+    }
+
+    facePlaneBuffer = std::make_shared<Buffer>(std::max<size_t>(numFaces, 1) * sizeof(glm::vec4),
+                                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                                                VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
-    adjacencyBuffer->uploadData(adjacency.data(), adjacencyBufferSize);
+
+    auto &context = VulkanContext::getContext();
+    auto shader = std::make_shared<Shader>("src/shader/spv/build_face_planes.comp.spv");
+    std::vector<DescriptorSet::BindingInfo> bindings = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Positions
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Cells
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Adjacency
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // Face planes
+    };
+    auto set = std::make_shared<DescriptorSet>(bindings);
+    set->bindBuffers(0, {positionBuffer->getBuffer()});
+    set->bindBuffers(1, {cellBuffer->getBuffer()});
+
+    struct
+    {
+        uint32_t firstCell;
+        uint32_t numCells;
+        uint32_t firstEntry;
+    } cons{};
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
+    std::vector<VkPushConstantRange> pushConstants{
+        {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cons)}};
+    auto pipeline = std::make_shared<ComputePipeline>(
+        shader->shaderModule, descriptorSetLayouts, pushConstants);
+    pipeline->addDescriptorSet(set);
+
+    for (auto &pass : passes)
+    {
+        if (!pass.numEntries)
+            continue;
+        set->bindBuffers(2, {adjacencyBuffer->getBuffer()}, pass.firstEntry * sizeof(uint32_t),
+                         pass.numEntries * sizeof(uint32_t));
+        set->bindBuffers(3, {facePlaneBuffer->getBuffer()}, pass.firstEntry * sizeof(glm::vec4),
+                         pass.numEntries * sizeof(glm::vec4));
+        cons = {static_cast<uint32_t>(pass.firstCell), static_cast<uint32_t>(pass.numCells),
+                static_cast<uint32_t>(pass.firstEntry)};
+
+        auto cmd = context.beginSingleTimeCommands();
+        pipeline->bindDescriptorSets(cmd);
+        pipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+        vkCmdDispatch(cmd, static_cast<uint32_t>(std::clamp<size_t>((pass.numCells + 255) / 256, 1, 65535)), 1, 1);
+        context.endSingleTimeCommands(cmd);
+    }
+
+    std::cout << std::format("Face planes: {} faces, +{}MB next to {}MB of adjacency\n", numFaces,
+                             facePlaneBuffer->getSize() >> 20, adjacencyBuffer->getSize() >> 20);
+}
+
+void RadFoam::buildSharedFaces(bool planes)
+{
+    if (faceCellBuffer)
+        return;
+    if (facePlaneBuffer || adjacencyStride || deltaOverflowBuffer)
+        throw std::runtime_error("Shared faces are built from the CSR adjacency, before face planes, padded or delta adjacency");
+    if (planes && positionBits)
+        throw std::runtime_error("Face planes need float32 positions, build them before quantizing");
+    requireAdjacency32("Shared faces");
+
+    std::vector<RadFoamCell> cells;
+    std::vector<int32_t> adjacency;
+    downloadCsr(cells, adjacency);
+    size_t numCells = cells.size();
+
+    auto findEntry = [&](int32_t cell, int32_t neighbour) -> int64_t
+    {
+        for (uint32_t a = cells[cell].adjacencyBegin; a < cells[cell].adjacencyEnd; ++a)
+            if (adjacency[a] == neighbour)
+                return a;
+        return -1;
+    };
+
+    // A face belongs to the lower cell of a pair that list each other; its faces are numbered in list order
+    std::vector<uint8_t> owned(adjacency.size());
+    std::vector<uint64_t> faceBegin(numCells + 1);
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint64_t count = 0;
+            for (uint32_t a = cells[i].adjacencyBegin; a < cells[i].adjacencyEnd; ++a)
+            {
+                int32_t j = adjacency[a];
+                owned[a] = j < 0 || size_t(j) >= numCells || size_t(j) >= i || findEntry(j, int32_t(i)) < 0;
+                count += owned[a];
+            }
+            faceBegin[i + 1] = count;
+        } });
+    for (size_t i = 0; i < numCells; ++i)
+        faceBegin[i + 1] += faceBegin[i];
+    size_t numFaces = faceBegin[numCells];
+    if (numFaces > INT32_MAX)
+        throw std::runtime_error("Shared faces: face ids exceed 31 bits");
+
+    std::vector<glm::ivec2> faceCells(numFaces);
+    std::vector<uint32_t> faceRefs(adjacency.size());
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint64_t face = faceBegin[i];
+            for (uint32_t a = cells[i].adjacencyBegin; a < cells[i].adjacencyEnd; ++a)
+            {
+                if (owned[a])
+                {
+                    faceCells[face] = glm::ivec2(int32_t(i), adjacency[a]);
+                    faceRefs[a] = static_cast<uint32_t>(face++ << 1);
+                    continue;
+                }
+                // The lower neighbour owns the face: its rank among that neighbour's own faces
+                int32_t j = adjacency[a];
+                uint64_t reverse = findEntry(j, int32_t(i));
+                uint64_t shared = faceBegin[j];
+                for (uint64_t b = cells[j].adjacencyBegin; b < reverse; ++b)
+                    shared += owned[b];
+                faceRefs[a] = static_cast<uint32_t>(shared << 1 | 1);
+            }
+        } });
+
+    faceCellBuffer = createDeviceBuffer(faceCells.data(), faceCells.size() * sizeof(glm::ivec2));
+    auto refBuffer = createDeviceBuffer(faceRefs.data(), faceRefs.size() * sizeof(uint32_t));
+
+    if (planes)
+    {
+        checkBindingRange(positionBuffer, "Shared face planes: positions");
+        facePlaneBuffer = std::make_shared<Buffer>(std::max<size_t>(numFaces, 1) * sizeof(glm::vec4),
+                                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                   VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+        auto &context = VulkanContext::getContext();
+        auto shader = std::make_shared<Shader>("src/shader/spv/build_shared_face_planes.comp.spv");
+        std::vector<DescriptorSet::BindingInfo> bindings = {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Positions
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Face cells
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // Face planes
+        };
+        auto set = std::make_shared<DescriptorSet>(bindings);
+        set->bindBuffers(0, {positionBuffer->getBuffer()});
+
+        uint32_t cons = 0;
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
+        std::vector<VkPushConstantRange> pushConstants{
+            {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cons)}};
+        auto pipeline = std::make_shared<ComputePipeline>(
+            shader->shaderModule, descriptorSetLayouts, pushConstants);
+        pipeline->addDescriptorSet(set);
+
+        // Passes over power-of-two face ranges keep the planes within maxStorageBufferRange
+        size_t facesPerPass = size_t(1) << 30;
+        while (facesPerPass > 256 && facesPerPass * sizeof(glm::vec4) > getMaxBindingRange())
+            facesPerPass >>= 1;
+        for (size_t first = 0; first < numFaces; first += facesPerPass)
+        {
+            size_t count = std::min(facesPerPass, numFaces - first);
+            set->bindBuffers(1, {faceCellBuffer->getBuffer()}, first * sizeof(glm::ivec2), count * sizeof(glm::ivec2));
+            set->bindBuffers(2, {facePlaneBuffer->getBuffer()}, first * sizeof(glm::vec4), count * sizeof(glm::vec4));
+            cons = static_cast<uint32_t>(count);
+
+            auto cmd = context.beginSingleTimeCommands();
+            pipeline->bindDescriptorSets(cmd);
+            pipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+            vkCmdDispatch(cmd, static_cast<uint32_t>(std::clamp<size_t>((count + 255) / 256, 1, 65535)), 1, 1);
+            context.endSingleTimeCommands(cmd);
+        }
+    }
+
+    std::cout << std::format("Shared faces: {} faces for {} adjacency entries, face table {}MB{}\n", numFaces,
+                             adjacency.size(), faceCellBuffer->getSize() >> 20,
+                             planes ? std::format(", planes {}MB instead of {}MB per entry", facePlaneBuffer->getSize() >> 20,
+                                                  (adjacency.size() * sizeof(glm::vec4)) >> 20)
+                                    : std::string());
+    adjacencyBuffer = refBuffer;
+}
+
+void RadFoam::buildPaddedAdjacency(bool keepCsr)
+{
+    if (adjacencyStride)
+        return;
+    if (facePlaneBuffer || faceCellBuffer)
+        throw std::runtime_error("Face planes and shared faces follow the CSR adjacency and cannot be combined with "
+                                 "padded adjacency");
+    requireAdjacency32("Padded adjacency");
+
+    std::vector<RadFoamCell> cells;
+    std::vector<int32_t> adjacency;
+    downloadCsr(cells, adjacency);
+    size_t numCells = cells.size();
+
+    std::vector<size_t> histogram;
+    for (auto &cell : cells)
+    {
+        uint32_t valence = cell.adjacencyEnd - cell.adjacencyBegin;
+        if (valence >= histogram.size())
+            histogram.resize(valence + 1);
+        histogram[valence]++;
+    }
+    size_t covered = 0;
+    uint32_t stride = 0;
+    while (stride + 1 < histogram.size() && covered + histogram[stride] < paddedAdjacencyCoverage * numCells)
+        covered += histogram[stride++];
+    // Whole uvec4 loads per cell
+    stride = std::max(4u, (stride + 3) & ~3u);
+
+    // Overflow ranges are a prefix sum over what does not fit the stride
+    std::vector<RadFoamCell> overflowCells(numCells);
+    size_t numOverflow = 0, numOverflowCells = 0;
+    for (size_t i = 0; i < numCells; ++i)
+    {
+        uint32_t valence = cells[i].adjacencyEnd - cells[i].adjacencyBegin;
+        uint32_t extra = valence > stride ? valence - stride : 0;
+        numOverflowCells += extra ? 1 : 0;
+        overflowCells[i] = {cells[i].density, static_cast<uint32_t>(numOverflow),
+                            static_cast<uint32_t>(numOverflow + extra)};
+        numOverflow += extra;
+    }
+    std::vector<int32_t> padded(numCells * stride);
+    std::vector<int32_t> overflow(numOverflow);
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint32_t valence = cells[i].adjacencyEnd - cells[i].adjacencyBegin;
+            const int32_t *neighbours = adjacency.data() + cells[i].adjacencyBegin;
+            for (uint32_t k = 0; k < stride; ++k)
+                padded[i * stride + k] = k < valence ? neighbours[k] : -1;
+            for (uint32_t k = stride; k < valence; ++k)
+                overflow[overflowCells[i].adjacencyBegin + k - stride] = neighbours[k];
+        } });
+
+    paddedAdjacencyBuffer = createDeviceBuffer(padded.data(), padded.size() * sizeof(int32_t));
+    auto overflowCellBuffer = createDeviceBuffer(overflowCells.data(), overflowCells.size() * sizeof(RadFoamCell));
+    auto overflowBuffer = createDeviceBuffer(overflow.data(), overflow.size() * sizeof(int32_t));
+
+    std::cout << std::format("Padded adjacency: {} neighbours per cell cover {:.1f}% of cells, {} overflow entries, "
+                             "{}MB -> {}MB\n",
+                             stride, 100.0 * (numCells - numOverflowCells) / std::max<size_t>(numCells, 1),
+                             numOverflow, adjacencyBuffer->getSize() >> 20,
+                             (paddedAdjacencyBuffer->getSize() + overflowBuffer->getSize()) >> 20);
+
+    if (keepCsr)
+    {
+        csrCellBuffer = cellBuffer;
+        csrAdjacencyBuffer = adjacencyBuffer;
+    }
+    cellBuffer = overflowCellBuffer;
+    adjacencyBuffer = overflowBuffer;
+    adjacencyStride = stride;
+}
+
+void RadFoam::buildDeltaAdjacency()
+{
+    if (deltaOverflowBuffer)
+        return;
+    if (adjacencyStride || faceCellBuffer)
+        throw std::runtime_error("Delta adjacency encodes CSR neighbours and cannot be combined with padded adjacency "
+                                 "or shared faces");
+    requireAdjacency32("Delta adjacency");
+
+    std::vector<RadFoamCell> cells;
+    std::vector<int32_t> adjacency;
+    downloadCsr(cells, adjacency);
+    size_t numCells = cells.size();
+
+    size_t numBlocks = (numCells + deltaAdjacencyBlockSize - 1) / deltaAdjacencyBlockSize;
+    auto isNear = [](int64_t delta)
+    { return delta >= -maxAdjacencyDelta - 1 && delta <= maxAdjacencyDelta; };
+    auto forEachBlockEntry = [&](size_t block, auto &&fn)
+    {
+        size_t end = std::min(numCells, (block + 1) * deltaAdjacencyBlockSize);
+        for (size_t i = block * deltaAdjacencyBlockSize; i < end; ++i)
+            for (uint32_t a = cells[i].adjacencyBegin; a < cells[i].adjacencyEnd; ++a)
+                fn(i, a);
+    };
+
+    // The overflow table starts with the base of every block's far neighbours
+    std::vector<uint32_t> numFar(numBlocks);
+    parallelFor(numBlocks, [&](size_t begin, size_t end)
+                {
+        for (size_t b = begin; b < end; ++b)
+            forEachBlockEntry(b, [&](size_t i, uint32_t a)
+                              { numFar[b] += isNear(int64_t(adjacency[a]) - int64_t(i)) ? 0 : 1; }); }, 16);
+    std::vector<int32_t> overflow(numBlocks);
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+        if (numFar[b] > 1u << 15)
+            throw std::runtime_error("Delta adjacency: too many far neighbours in one block, reorder the scene "
+                                     "with radfoam-convert --reorder");
+        overflow[b] = static_cast<int32_t>(overflow.size());
+        overflow.resize(overflow.size() + numFar[b]);
+    }
+
+    std::vector<uint16_t> entries((adjacency.size() + 1) & ~size_t(1));
+    parallelFor(numBlocks, [&](size_t begin, size_t end)
+                {
+        for (size_t b = begin; b < end; ++b)
+        {
+            uint32_t far = 0;
+            forEachBlockEntry(b, [&](size_t i, uint32_t a)
+                              {
+                int64_t delta = int64_t(adjacency[a]) - int64_t(i);
+                if (isNear(delta))
+                    entries[a] = static_cast<uint16_t>(uint32_t(delta) << 1);
+                else
+                {
+                    overflow[overflow[b] + far] = adjacency[a];
+                    entries[a] = static_cast<uint16_t>(far++ << 1 | 1);
+                } });
+        } }, 16);
+
+    // Decode everything the way ray_tracing.comp does before the CSR adjacency is dropped
+    std::atomic<size_t> mismatches = 0;
+    parallelFor(numBlocks, [&](size_t begin, size_t end)
+                {
+        size_t local = 0;
+        for (size_t b = begin; b < end; ++b)
+            forEachBlockEntry(b, [&](size_t i, uint32_t a)
+                              {
+                int16_t entry = static_cast<int16_t>(entries[a]);
+                int32_t neighbour = (entry & 1) ? overflow[overflow[i / deltaAdjacencyBlockSize] + (uint16_t(entry) >> 1)]
+                                                : static_cast<int32_t>(i) + (entry >> 1);
+                local += neighbour != adjacency[a] ? 1 : 0; });
+        mismatches += local; }, 16);
+    if (mismatches)
+        throw std::runtime_error(std::format("Delta adjacency: {} entries do not decode to their neighbour",
+                                             mismatches.load()));
+
+    auto entryBuffer = createDeviceBuffer(entries.data(), entries.size() * sizeof(uint16_t));
+    deltaOverflowBuffer = createDeviceBuffer(overflow.data(), overflow.size() * sizeof(int32_t));
+
+    size_t numOverflow = overflow.size() - numBlocks;
+    std::cout << std::format("Delta adjacency: {:.1f}% of neighbours within 16 bits, {} overflow entries, "
+                             "{}MB -> {}MB, validated\n",
+                             100.0 * (adjacency.size() - numOverflow) / std::max<size_t>(adjacency.size(), 1),
+                             numOverflow, adjacencyBuffer->getSize() >> 20,
+                             (entryBuffer->getSize() + deltaOverflowBuffer->getSize()) >> 20);
+    adjacencyBuffer = entryBuffer;
+}
+
+void RadFoam::quantizePositionBuffer(uint32_t bits, bool keepFloat)
+{
+    if (positionBits)
+        return;
+    if (bits < 8 || bits > 21)
+        throw std::runtime_error(std::format("Position quantization supports 8 to 21 bits per axis, not {}", bits));
+
+    size_t numCells = getNumStoredCells();
+    size_t numBlocks = (numCells + positionBlockSize - 1) / positionBlockSize;
+    auto usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    // The ray tracer reads pairs of cells as uvec4
+    auto quantized = std::make_shared<Buffer>(std::max<size_t>((numCells + 1) / 2, 1) * 2 * sizeof(glm::uvec2),
+                                              usage, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    positionBlockBuffer = std::make_shared<Buffer>(std::max<size_t>(numBlocks, 1) * sizeof(PositionBlock), usage,
+                                                   VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    auto &context = VulkanContext::getContext();
+    auto shader = std::make_shared<Shader>("src/shader/spv/quantize_positions.comp.spv");
+    std::vector<DescriptorSet::BindingInfo> bindings = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // float32 positions
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Blocks
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // Quantized positions
+    };
+    auto set = std::make_shared<DescriptorSet>(bindings);
+
+    struct
+    {
+        uint32_t numCells;
+        uint32_t bits;
+    } cons{0, bits};
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
+    std::vector<VkPushConstantRange> pushConstants{
+        {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cons)}};
+    auto pipeline = std::make_shared<ComputePipeline>(
+        shader->shaderModule, descriptorSetLayouts, pushConstants);
+    pipeline->addDescriptorSet(set);
+
+    // Passes over power-of-two runs of whole blocks keep the float32 binding within maxStorageBufferRange
+    size_t cellsPerPass = size_t(1) << 30;
+    while (cellsPerPass > positionBlockSize && cellsPerPass * sizeof(glm::vec4) > getMaxBindingRange())
+        cellsPerPass >>= 1;
+    for (size_t first = 0; first < numCells; first += cellsPerPass)
+    {
+        size_t count = std::min(cellsPerPass, numCells - first);
+        size_t passBlocks = (count + positionBlockSize - 1) / positionBlockSize;
+        set->bindBuffers(0, {positionBuffer->getBuffer()}, first * sizeof(glm::vec4), count * sizeof(glm::vec4));
+        set->bindBuffers(1, {positionBlockBuffer->getBuffer()}, first / positionBlockSize * sizeof(PositionBlock),
+                         passBlocks * sizeof(PositionBlock));
+        set->bindBuffers(2, {quantized->getBuffer()}, first * sizeof(glm::uvec2),
+                         (count + 1) / 2 * 2 * sizeof(glm::uvec2));
+        cons.numCells = static_cast<uint32_t>(count);
+
+        // One workgroup per block, folded into two dimensions for large scenes
+        auto groupsX = static_cast<uint32_t>(std::clamp<size_t>(passBlocks, 1, 65535));
+        auto groupsY = static_cast<uint32_t>(std::max<size_t>((passBlocks + groupsX - 1) / groupsX, 1));
+        auto cmd = context.beginSingleTimeCommands();
+        pipeline->bindDescriptorSets(cmd);
+        pipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+        vkCmdDispatch(cmd, groupsX, groupsY, 1);
+        context.endSingleTimeCommands(cmd);
+    }
+
+    // Worst-case rounding error is half a step of the coarsest block
+    std::vector<PositionBlock> blocks(numBlocks);
+    if (numBlocks)
+        positionBlockBuffer->downloadData(blocks.data(), numBlocks * sizeof(PositionBlock));
+    float maxError = 0.0f;
+    for (auto &block : blocks)
+        maxError = std::max(maxError, 0.5f * glm::length(glm::vec3(block.step)));
+    std::cout << std::format("Quantized positions: {} bits per axis, {}MB -> {}MB, max error {:.3g}\n", bits,
+                             positionBuffer->getSize() >> 20,
+                             (quantized->getSize() + positionBlockBuffer->getSize()) >> 20, maxError);
+
+    if (keepFloat)
+        floatPositionBuffer = positionBuffer;
+    positionBuffer = quantized;
+    positionBits = bits;
+}
+
+VkDeviceSize RadFoam::getMaxBindingRange()
+{
+    return VulkanContext::getContext().getPhysicalDeviceProperties().limits.maxStorageBufferRange;
+}
+
+void RadFoam::checkBindingRange(const std::shared_ptr<Buffer> &buffer, const std::string &name)
+{
+    if (buffer->getSize() > getMaxBindingRange())
+        throw std::runtime_error(std::format("{} of {}MB exceed the {}MB maxStorageBufferRange of one binding", name,
+                                             buffer->getSize() >> 20, getMaxBindingRange() >> 20));
+}
+
+std::shared_ptr<Buffer> RadFoam::createDeviceBuffer(const void *data, size_t size)
+{
+    auto buffer = std::make_shared<Buffer>(std::max<size_t>(size, 4),
+                                           VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                           VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    if (size)
+        buffer->uploadData(data, size);
+    return buffer;
+}
+
+void RadFoam::downloadCsr(std::vector<RadFoamCell> &cells, std::vector<int32_t> &adjacency) const
+{
+    cells.resize(getNumStoredCells());
+    adjacency.resize(adjacencyBuffer->getSize() / sizeof(uint32_t));
+    cellBuffer->downloadData(cells.data(), cells.size() * sizeof(RadFoamCell));
+    if (!adjacency.empty())
+        adjacencyBuffer->downloadData(adjacency.data(), adjacency.size() * sizeof(uint32_t));
+    for (auto &cell : cells)
+        if (cell.adjacencyEnd < cell.adjacencyBegin || cell.adjacencyEnd > adjacency.size())
+            throw std::runtime_error("Adjacency offsets out of range");
+}
+
+void RadFoam::selectShFormat(uint32_t degree)
+{
+    sourceShDegree = degree;
+    sourceNumShCoeffs = 3 * (degree + 1) * (degree + 1);
+    ShFormat format{degree, false};
+    if (chooseShFormat)
+        format = chooseShFormat(numVertices, numAdjacency, degree);
+    shDegree = std::min(format.degree, degree);
+    numShCoeffs = 3 * (shDegree + 1) * (shDegree + 1);
+    shHalf = format.half;
+    if (!hasSourceSh())
+        std::cout << std::format("Loading SH degree {} as {} degree {}\n", sourceShDegree,
+                                 shHalf ? "float16" : "float32", shDegree);
+}
+
+size_t RadFoam::getShCellSize() const
+{
+    return shHalf ? getShHalfWords(numShCoeffs) * sizeof(uint32_t) : numShCoeffs * sizeof(float);
+}
+
+void RadFoam::convertSourceSh(const float *src, size_t count, void *dst) const
+{
+    if (shHalf)
+    {
+        packShHalf(src, count, numShCoeffs, static_cast<uint32_t *>(dst), sourceNumShCoeffs);
+        return;
+    }
+    // The leading bands of every cell are kept; higher bands are dropped
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+            std::memcpy(static_cast<float *>(dst) + i * numShCoeffs, src + i * sourceNumShCoeffs,
+                        numShCoeffs * sizeof(float)); });
+}
+
+void RadFoam::createBuffers(size_t numCells, size_t numAdjacency)
+{
+    // Loading may start on a worker thread before the window and device are up
+    VulkanContext::getContext().waitForDevice();
+
+    auto usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    auto create = [usage](size_t size)
+    { return std::make_shared<Buffer>(size, usage, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE); };
+    // Byte sizes and offsets are 64-bit throughout. Adjacency entries are int cell ids with -1 for
+    // none, so cells stay within 31 bits; adjacency offsets carry their high word in the wraps
+    if (numCells > INT32_MAX || (numAdjacency >> 32) > maxAdjacencyWraps)
+        throw std::runtime_error(std::format("Scene of {} cells and {} adjacency entries exceeds the 31-bit cell ids "
+                                             "and the {} adjacency wraps of the ray tracer",
+                                             numCells, numAdjacency, maxAdjacencyWraps));
+    positionBuffer = create(sizeof(glm::vec4) * numCells);
+    cellBuffer = create(sizeof(RadFoamCell) * numCells);
+    shBuffer = create(getShCellSize() * numCells);
+    adjacencyBuffer = create(sizeof(uint32_t) * numAdjacency);
+}
+
+void RadFoam::scanAdjacencyWraps(const RadFoamCell *cells, size_t firstCell, size_t count, uint64_t &end,
+                                 std::vector<uint32_t> &wraps)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (cells[i].adjacencyBegin != static_cast<uint32_t>(end))
+            throw std::runtime_error(std::format("Adjacency range of cell {} does not follow the previous one",
+                                                 firstCell + i));
+        // A cell holds less than 2^32 neighbours, so its begin is at most one wrap further
+        uint64_t begin = end;
+        if ((begin >> 32) > wraps.size())
+            wraps.push_back(static_cast<uint32_t>(firstCell + i));
+        end = extendOffset(begin, cells[i].adjacencyEnd);
+    }
+}
+
+void RadFoam::findAdjacencyWraps()
+{
+    constexpr size_t cellsPerBatch = size_t(1) << 20;
+    std::vector<RadFoamCell> cells;
+    uint64_t end = 0;
+    adjacencyWraps.clear();
+    for (size_t first = 0; first < numVertices; first += cellsPerBatch)
+    {
+        size_t count = std::min<size_t>(cellsPerBatch, numVertices - first);
+        cells.resize(count);
+        cellBuffer->downloadData(cells.data(), count * sizeof(RadFoamCell), first * sizeof(RadFoamCell));
+        scanAdjacencyWraps(cells.data(), first, count, end, adjacencyWraps);
+    }
+    if (end != numAdjacency)
+        throw std::runtime_error(std::format("Adjacency ranges end at {} of {} entries", end, numAdjacency));
+    std::cout << std::format("{} adjacency entries: offsets wrap at {} cells\n", numAdjacency, adjacencyWraps.size());
+}
+
+void RadFoam::requireAdjacency32(const std::string &pass) const
+{
+    if (adjacencyBuffer->getSize() / sizeof(uint32_t) > UINT32_MAX)
+        throw std::runtime_error(std::format("{} walk the adjacency with 32-bit offsets, this scene has {} entries", pass,
+                                             adjacencyBuffer->getSize() / sizeof(uint32_t)));
+}
+
+bool RadFoam::loadFromCache(SceneCache &cache)
+{
+    auto &header = cache.getHeader();
+    numVertices = header.numVertices;
+    numAdjacency = header.numAdjacency;
+
+    // Cached sections already hold the GPU layout: stream the payload once, hashing it on
+    // the way, and route every byte range to its staging slot or host array.
+    // The reader starts before the buffers so disk reads overlap device creation.
+    size_t payloadBegin = SceneCache::sectionAlignment;
+    ChunkReader reader(cache.getFilePath(), payloadBegin, cache.getFileSize() - payloadBegin,
+                       StreamingUploader::defaultSlotSize);
+
+    selectShFormat(header.shDegree);
+    createBuffers(numVertices, numAdjacency);
+    positions.resize(numVertices);
+    auto &aabbs = cache.getHostSection(SceneCache::AABBs);
+    aabbs.resize(cache.getSection(SceneCache::AABBs).size);
+    auto &aabbOrder = cache.getHostSection(SceneCache::AABBOrder);
+    aabbOrder.resize(cache.getSection(SceneCache::AABBOrder).size);
+
+    StreamingUploader uploader;
+    SceneCache::Hasher hasher;
+    // SH in another format are converted by whole cells, which may straddle chunks
+    std::vector<char> shCarry;
+    size_t shCellsStaged = 0;
+    size_t sourceShCellSize = sourceNumShCoeffs * sizeof(float);
+
+    struct Target
+    {
+        SceneCache::SectionId id;
+        Buffer *buffer;
+        char *host;
+    };
+    const Target targets[] = {
+        {SceneCache::PositionStream, positionBuffer.get(), nullptr},
+        {SceneCache::Cells, cellBuffer.get(), nullptr},
+        {SceneCache::SphericalHarmonics, shBuffer.get(), nullptr},
+        {SceneCache::Adjacency, adjacencyBuffer.get(), nullptr},
+        {SceneCache::Positions, nullptr, reinterpret_cast<char *>(positions.data())},
+        {SceneCache::AABBs, nullptr, aabbs.data()},
+        {SceneCache::AABBOrder, nullptr, aabbOrder.data()},
+    };
+
+    ChunkReader::Chunk chunk;
+    while (reader.next(chunk))
+    {
+        hasher.update(chunk.data, chunk.size);
+        size_t chunkBegin = payloadBegin + chunk.offset;
+        size_t chunkEnd = chunkBegin + chunk.size;
+
+        for (auto &target : targets)
+        {
+            auto &section = cache.getSection(target.id);
+            size_t begin = std::max<size_t>(chunkBegin, section.offset);
+            size_t end = std::min<size_t>(chunkEnd, section.offset + section.size);
+            if (begin >= end)
+                continue;
+
+            const char *src = chunk.data + (begin - chunkBegin);
+            if (target.id == SceneCache::SphericalHarmonics && !hasSourceSh())
+            {
+                shCarry.insert(shCarry.end(), src, src + (end - begin));
+                size_t count = shCarry.size() / sourceShCellSize;
+                if (count == 0)
+                    continue;
+                auto staged = uploader.stage({{shBuffer.get(), shCellsStaged * getShCellSize(),
+                                               count * getShCellSize()}});
+                convertSourceSh(reinterpret_cast<const float *>(shCarry.data()), count, staged[0]);
+                shCarry.erase(shCarry.begin(), shCarry.begin() + count * sourceShCellSize);
+                shCellsStaged += count;
+            }
+            else if (target.buffer)
+            {
+                auto staged = uploader.stage({{target.buffer, begin - section.offset, end - begin}});
+                std::memcpy(staged[0], src, end - begin);
+            }
+            else
+            {
+                std::memcpy(target.host + (begin - section.offset), src, end - begin);
+            }
+        }
+        reader.release(chunk);
+    }
+    uploader.flush();
+
+    std::cout << std::format("Streamed {}MB from cache: reader stalls {:.0f}ms, GPU stalls {:.0f}ms\n",
+                             uploader.getBytesUploaded() >> 20, reader.getWaitMs(), uploader.getFenceWaitMs());
+    return hasher.finish() == header.contentHash;
+}
+
+void RadFoam::loadFromPack(const std::string &path)
+{
+    ScenePack pack(path);
+    auto &header = pack.getHeader();
+    auto &blocks = pack.getBlocks();
+    numVertices = header.numVertices;
+    numAdjacency = header.numAdjacency;
+
+    selectShFormat(header.shDegree);
+    createBuffers(numVertices, numAdjacency);
+    positions.resize(numVertices);
+
+    // Blocks are grouped into batches that fill one staging slot, and every batch is
+    // decoded on all cores straight into the mapped slot
+    size_t maxBlockSize = 0;
+    for (size_t b = 0; b < blocks.size(); ++b)
+        maxBlockSize = std::max(maxBlockSize, pack.getDecodedSize(b, b + 1));
+    StreamingUploader uploader(std::max<VkDeviceSize>(StreamingUploader::defaultSlotSize, maxBlockSize + 64));
+    // SH in another format are decoded here first, as the paged scene does
+    std::vector<float> shScratch;
+
+    size_t first = 0;
+    while (first < blocks.size())
+    {
+        size_t last = first + 1;
+        while (last < blocks.size() && pack.getDecodedSize(first, last + 1) + 64 <= uploader.getSlotSize())
+            ++last;
+
+        auto &begin = blocks[first];
+        auto &end = blocks[last - 1];
+        size_t numCells = end.firstCell + end.numCells - begin.firstCell;
+        size_t batchAdjacency = end.adjacencyBegin + end.numAdjacency - begin.adjacencyBegin;
+        auto staged = uploader.stage({
+            {positionBuffer.get(), begin.firstCell * sizeof(glm::vec4), numCells * sizeof(glm::vec4)},
+            {cellBuffer.get(), begin.firstCell * sizeof(RadFoamCell), numCells * sizeof(RadFoamCell)},
+            {shBuffer.get(), begin.firstCell * getShCellSize(), numCells * getShCellSize()},
+            {adjacencyBuffer.get(), begin.adjacencyBegin * sizeof(uint32_t), batchAdjacency * sizeof(uint32_t)},
+        });
+        if (!hasSourceSh())
+            shScratch.resize(numCells * sourceNumShCoeffs);
+        pack.decode(first, last, {static_cast<glm::vec4 *>(staged[0]), static_cast<RadFoamCell *>(staged[1]),
+                                  hasSourceSh() ? static_cast<float *>(staged[2]) : shScratch.data(),
+                                  static_cast<uint32_t *>(staged[3]), positions.data() + begin.firstCell});
+        if (!hasSourceSh())
+            convertSourceSh(shScratch.data(), numCells, staged[2]);
+        first = last;
+    }
+    uploader.flush();
+
+    std::cout << std::format("Decoded {} pack blocks into {}MB, GPU stalls {:.0f}ms\n",
+                             blocks.size(), uploader.getBytesUploaded() >> 20, uploader.getFenceWaitMs());
+}
+
+void RadFoam::uploadRadFoam(const RadFoamPly &ply)
+{
+    auto &schema = ply.getSchema();
+    numVertices = ply.getNumVertices();
+    numAdjacency = ply.getNumAdjacency();
+    numShCoeffs = ply.getNumShCoeffs();
+
+    // Pipeline: reader threads fill chunks from disk, this thread converts them into staging
+    // slots and the GPU copies every slot as soon as it is submitted.
+    // The readers start before the buffers so disk reads overlap device creation.
+    constexpr size_t slotSize = StreamingUploader::defaultSlotSize;
+    size_t verticesPerChunk = slotSize / (sizeof(glm::vec4) + sizeof(RadFoamCell) + sizeof(float) * numShCoeffs + 32);
+    size_t adjacencyPerChunk = slotSize / sizeof(uint32_t);
+
+    ChunkReader vertexReader(ply.getPath(), ply.getVertexDataOffset(), size_t(numVertices) * schema.stride,
+                             verticesPerChunk * schema.stride);
+    ChunkReader adjacencyReader(ply.getPath(), ply.getAdjacencyDataOffset(),
+                                size_t(numAdjacency) * schema.adjacencyStride,
+                                adjacencyPerChunk * schema.adjacencyStride);
+
+    selectShFormat(ply.getShDegree());
+    createBuffers(numVertices, numAdjacency);
+    positions.resize(numVertices);
+    StreamingUploader uploader;
+    uint32_t adjacencyBegin = 0;
+    std::vector<float> shScratch;
+
+    ChunkReader::Chunk chunk;
+    while (vertexReader.next(chunk))
+    {
+        size_t first = chunk.offset / schema.stride;
+        size_t count = chunk.size / schema.stride;
+        auto staged = uploader.stage({
+            {positionBuffer.get(), first * sizeof(glm::vec4), count * sizeof(glm::vec4)},
+            {cellBuffer.get(), first * sizeof(RadFoamCell), count * sizeof(RadFoamCell)},
+            {shBuffer.get(), first * getShCellSize(), count * getShCellSize()},
+        });
+        if (!hasSourceSh())
+            shScratch.resize(count * sourceNumShCoeffs);
+        ply.convertVertexData(chunk.data, count, adjacencyBegin, static_cast<glm::vec4 *>(staged[0]),
+                              static_cast<RadFoamCell *>(staged[1]),
+                              hasSourceSh() ? static_cast<float *>(staged[2]) : shScratch.data(),
+                              positions.data() + first);
+        if (!hasSourceSh())
+            convertSourceSh(shScratch.data(), count, staged[2]);
+        adjacencyBegin = ply.getAdjacencyEnd(chunk.data + (count - 1) * schema.stride);
+        vertexReader.release(chunk);
+    }
+
+    while (adjacencyReader.next(chunk))
+    {
+        size_t first = chunk.offset / schema.adjacencyStride;
+        size_t count = chunk.size / schema.adjacencyStride;
+        auto staged = uploader.stage({{adjacencyBuffer.get(), first * sizeof(uint32_t), count * sizeof(uint32_t)}});
+        ply.convertAdjacencyData(chunk.data, count, static_cast<uint32_t *>(staged[0]));
+        adjacencyReader.release(chunk);
+    }
+    uploader.flush();
+
+    std::cout << std::format("Streamed {}MB from PLY: reader stalls {:.0f}ms, GPU stalls {:.0f}ms\n",
+                             uploader.getBytesUploaded() >> 20,
+                             vertexReader.getWaitMs() + adjacencyReader.getWaitMs(),
+                             uploader.getFenceWaitMs());
 }
 
 AABBTree::AABBTree(std::shared_ptr<RadFoam> pModel) : pModel(pModel)
@@ -118,20 +1295,233 @@ AABBTree::AABBTree(std::shared_ptr<RadFoam> pModel) : pModel(pModel)
     auto getLevel = [](uint32_t x)
     { return x > 1 ? glm::log2(x - 1) + 1 : 1; };
 
-    auto numVertices = pModel->getNumVertices();
+    // createBuffers keeps cells within 31 bits
+    auto numVertices = static_cast<uint32_t>(pModel->getNumVertices());
     numLevels = getLevel(numVertices);
 
-    size_t aabbBufferSize = sizeof(AABB) * (1 << numLevels);
-    aabbBuffer = std::make_shared<Buffer>(aabbBufferSize,
-                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                          VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    auto pCache = pModel->getCache();
+    if (pCache && pCache->getHeader().numAABBLevels == numLevels)
+    {
+        // Prebuilt tree: only the host copy is used, by nearestNeighbor()
+        auto &nodes = pCache->getHostSection(SceneCache::AABBs);
+        aabbTree.resize(1 << numLevels);
+        std::memcpy(aabbTree.data(), nodes.data(), nodes.size());
+        auto &order = pCache->getHostSection(SceneCache::AABBOrder);
+        leafOrder.resize(numVertices);
+        std::memcpy(leafOrder.data(), order.data(), order.size());
+        std::cout << "Initialize AABB Tree from cache: numLevels(" << numLevels << ")" << std::endl;
+        return;
+    }
 
-    buildAABBLeaves();
-    buildAABBTree();
-    downloadAABBTree();
+    auto startTime = std::chrono::high_resolution_clock::now();
+    sortPoints();
+    // A tree beyond one binding is assembled on the host from the sorted order instead
+    size_t aabbBufferSize = sizeof(AABB) * (size_t(1) << numLevels);
+    if (aabbBufferSize <= RadFoam::getMaxBindingRange())
+    {
+        aabbBuffer = std::make_shared<Buffer>(aabbBufferSize,
+                                              VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                              VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+        buildAABBLeaves();
+        buildAABBTree();
+        downloadAABBTree();
+    }
+    else
+        buildOnHost();
+    aabbBuffer.reset();
+    orderBuffer.reset();
+    auto buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
     std::cout << "Initialize AABB Tree: numLevels(" << numLevels << ")" << std::endl;
+    printQuality(buildMs);
+}
+
+void AABBTree::sortPoints()
+{
+    auto &context = VulkanContext::getContext();
+    uint32_t numPoints = static_cast<uint32_t>(pModel->getNumVertices());
+
+    // Morton codes quantize the bounds to 10 bits per axis, one scale for all axes
+    glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+    std::mutex mutex;
+    parallelFor(numPoints, [&](size_t begin, size_t end)
+                {
+        glm::vec3 localMin(INFINITY), localMax(-INFINITY);
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::vec3 p = pModel->getPosition(static_cast<uint32_t>(i));
+            localMin = glm::min(localMin, p);
+            localMax = glm::max(localMax, p);
+        }
+        std::lock_guard lock(mutex);
+        boundsMin = glm::min(boundsMin, localMin);
+        boundsMax = glm::max(boundsMax, localMax); });
+    float extent = std::max(glm::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z);
+
+    // Must match lbvh_histogram.comp and lbvh_scatter.comp
+    constexpr uint32_t keyBits = 30;
+    constexpr uint32_t radixBits = 4;
+    constexpr uint32_t numDigits = 1 << radixBits;
+    constexpr uint32_t tileSize = 128 * 32;
+    constexpr uint32_t numPasses = (keyBits + radixBits - 1) / radixBits;
+    static_assert(numPasses % 2 == 0, "the sorted keys must end in the A buffers");
+    uint32_t numTiles = (numPoints + tileSize - 1) / tileSize;
+
+    auto usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    auto create = [usage](size_t size)
+    { return std::make_shared<Buffer>(size, usage, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE); };
+    auto keysA = create(sizeof(uint32_t) * numPoints);
+    auto valuesA = create(sizeof(uint32_t) * numPoints);
+    auto keysB = create(sizeof(uint32_t) * numPoints);
+    auto valuesB = create(sizeof(uint32_t) * numPoints);
+    auto histogram = create(sizeof(uint32_t) * numDigits * numTiles);
+
+    // One set for every pass; the passes pick the ping-pong direction by push constant
+    std::vector<DescriptorSet::BindingInfo> bindings = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Position Buffer
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Keys A
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Point ids A
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Keys B
+        {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Point ids B
+        {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // Digit counts per tile
+    };
+    auto set = std::make_shared<DescriptorSet>(bindings);
+    set->bindBuffers(3, {keysB->getBuffer()});
+    set->bindBuffers(4, {valuesB->getBuffer()});
+    set->bindBuffers(5, {histogram->getBuffer()});
+
+    struct
+    {
+        glm::vec3 boundsMin;
+        float scale;
+        uint32_t numPoints;
+        uint32_t firstPoint;
+    } mortonCons{boundsMin, extent > 0.0f ? 1023.0f / extent : 0.0f, 0, 0};
+    struct SortConstants
+    {
+        uint32_t numPoints;
+        uint32_t shift;
+        uint32_t numTiles;
+        uint32_t fromB;
+    };
+    struct
+    {
+        uint32_t count;
+    } scanCons{numDigits * numTiles};
+
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
+    std::vector<std::shared_ptr<Shader>> shaders;
+    auto makePipeline = [&](const std::string &path, uint32_t pushSize)
+    {
+        shaders.push_back(std::make_shared<Shader>(path));
+        std::vector<VkPushConstantRange> pushConstants{{VK_SHADER_STAGE_COMPUTE_BIT, 0, pushSize}};
+        auto pipeline = std::make_shared<ComputePipeline>(shaders.back()->shaderModule, descriptorSetLayouts,
+                                                          pushConstants);
+        pipeline->addDescriptorSet(set);
+        return pipeline;
+    };
+    auto mortonPipeline = makePipeline("src/shader/spv/lbvh_morton.comp.spv", sizeof(mortonCons));
+    auto histogramPipeline = makePipeline("src/shader/spv/lbvh_histogram.comp.spv", sizeof(SortConstants));
+    auto scanPipeline = makePipeline("src/shader/spv/lbvh_scan.comp.spv", sizeof(scanCons));
+    auto scatterPipeline = makePipeline("src/shader/spv/lbvh_scatter.comp.spv", sizeof(SortConstants));
+
+    // Morton codes over power-of-two point ranges keep the positions within maxStorageBufferRange
+    size_t pointsPerPass = size_t(1) << 30;
+    while (pointsPerPass > 256 && pointsPerPass * sizeof(glm::vec4) > RadFoam::getMaxBindingRange())
+        pointsPerPass >>= 1;
+    for (size_t first = 0; first < numPoints; first += pointsPerPass)
+    {
+        size_t count = std::min<size_t>(pointsPerPass, numPoints - first);
+        set->bindBuffers(0, {pModel->getPositionBuffer()->getBuffer()}, first * sizeof(glm::vec4),
+                         count * sizeof(glm::vec4));
+        set->bindBuffers(1, {keysA->getBuffer()}, first * sizeof(uint32_t), count * sizeof(uint32_t));
+        set->bindBuffers(2, {valuesA->getBuffer()}, first * sizeof(uint32_t), count * sizeof(uint32_t));
+        mortonCons.numPoints = static_cast<uint32_t>(count);
+        mortonCons.firstPoint = static_cast<uint32_t>(first);
+
+        auto cmd = context.beginSingleTimeCommands();
+        mortonPipeline->bindDescriptorSets(cmd);
+        mortonPipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(mortonCons), &mortonCons);
+        vkCmdDispatch(cmd, static_cast<uint32_t>(std::clamp<size_t>((count + 255) / 256, 1, 65535)), 1, 1);
+        context.endSingleTimeCommands(cmd);
+    }
+    set->bindBuffers(1, {keysA->getBuffer()});
+    set->bindBuffers(2, {valuesA->getBuffer()});
+
+    // Every pass counts digits per tile, scans the counts, then scatters stably; all in one submit
+    auto cmd = context.beginSingleTimeCommands();
+    auto barrier = [cmd]()
+    {
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+    };
+
+    uint32_t groupsX = std::min(numTiles, 65535u);
+    uint32_t groupsY = (numTiles + groupsX - 1) / groupsX;
+    for (uint32_t pass = 0; pass < numPasses; ++pass)
+    {
+        SortConstants cons{numPoints, pass * radixBits, numTiles, pass & 1};
+        histogramPipeline->bindDescriptorSets(cmd);
+        histogramPipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+        vkCmdDispatch(cmd, groupsX, groupsY, 1);
+        barrier();
+        scanPipeline->bindDescriptorSets(cmd);
+        scanPipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(scanCons), &scanCons);
+        vkCmdDispatch(cmd, 1, 1, 1);
+        barrier();
+        scatterPipeline->bindDescriptorSets(cmd);
+        scatterPipeline->pushConstants(cmd, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(cons), &cons);
+        vkCmdDispatch(cmd, groupsX, groupsY, 1);
+        barrier();
+    }
+    context.endSingleTimeCommands(cmd);
+
+    orderBuffer = valuesA;
+}
+
+void AABBTree::printQuality(double buildMs)
+{
+    auto area = [](const AABB &node)
+    {
+        glm::vec3 e = glm::max(node.max - node.min, glm::vec3(0.0f));
+        return 2.0 * (double(e.x) * e.y + double(e.y) * e.z + double(e.z) * e.x);
+    };
+
+    // Over the nodes nearestNeighbor() can reach, relative to the root
+    uint32_t numVertices = static_cast<uint32_t>(pModel->getNumVertices());
+    double areaSum = 0.0;
+    size_t numNodes = 0;
+    for (uint32_t level = 0; level < numLevels; ++level)
+    {
+        uint32_t div = numLevels - level;
+        size_t width = (size_t(numVertices) + (size_t(1) << div) - 1) >> div;
+        size_t levelStart = (size_t(1) << numLevels) - (size_t(1) << (level + 1));
+        for (size_t i = 0; i < width; ++i)
+            areaSum += area(aabbTree[levelStart + i]);
+        numNodes += width;
+    }
+    double rootArea = area(aabbTree[(size_t(1) << numLevels) - 2]);
+
+    // Queries at evenly spaced cells, as the camera start point search does
+    constexpr uint32_t maxQueries = 1024;
+    uint32_t numQueries = std::min(maxQueries, numVertices);
+    uint64_t nodesVisited = 0;
+    for (uint32_t q = 0; q < numQueries; ++q)
+    {
+        glm::vec3 pos = pModel->getPosition(static_cast<uint32_t>(uint64_t(q) * numVertices / numQueries));
+        findNearest(pos, nodesVisited);
+    }
+
+    std::cout << std::format("AABB tree quality: built in {:.1f}ms, mean node surface area {:.3g} of the root, "
+                             "{:.1f} nodes visited per nearest-cell query\n",
+                             buildMs, rootArea > 0.0 ? areaSum / numNodes / rootArea : 0.0,
+                             numQueries ? double(nodesVisited) / numQueries : 0.0);
 }
 
 void AABBTree::buildAABBLeaves()
@@ -141,16 +1531,17 @@ void AABBTree::buildAABBLeaves()
 
     // Create descriptor set
     std::vector<DescriptorSet::BindingInfo> bindings = {
-        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Vertex Buffer
-        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // AABB Buffer
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // Position Buffer
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}, // AABB Buffer
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}  // Morton order
     };
     auto set = std::make_shared<DescriptorSet>(bindings);
-    set->bindBuffers(0, {pModel->getVertexBuffer()->getBuffer()});
+    set->bindBuffers(0, {pModel->getPositionBuffer()->getBuffer()});
     set->bindBuffers(1, {aabbBuffer->getBuffer()});
+    set->bindBuffers(2, {orderBuffer->getBuffer()});
 
     // Create compute pipeline
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts{set->getDescriptorSetLayout()};
-    // std::vector<VkPushConstantRange> pushConstants;
     auto pipeline = std::make_shared<ComputePipeline>(
         shader->shaderModule, descriptorSetLayouts);
     pipeline->addDescriptorSet(set);
@@ -160,34 +1551,6 @@ void AABBTree::buildAABBLeaves()
     auto workGroups = ((1 << numLevels - 1) + 255) / 256;
     vkCmdDispatch(cmd, workGroups, 1, 1);
     context.endSingleTimeCommands(cmd);
-
-    std::vector<AABB> tmp(1u << numLevels);
-    aabbBuffer->downloadData(tmp.data(), aabbBuffer->getSize());
-
-    // int x = 10000;
-    // std::cout << x << std::endl;
-    // for (int i = x; i < x + 1; i++)
-    // {
-    //     // std::cout << tmp[i].min[0] << ' ';
-    //     // std::cout << tmp[i].min[1] << ' ';
-    //     // std::cout << tmp[i].min[2] << std::endl;
-    //     // std::cout << tmp[i].max[0] << ' ';
-    //     // std::cout << tmp[i].max[1] << ' ';
-    //     // std::cout << tmp[i].max[2] << std::endl;
-    //     std::cout << pModel->vertices[i * 2].sh_coeffs[0] << ' ';
-    //     std::cout << pModel->vertices[i * 2].sh_coeffs[47] << ' ';
-    //     // std::cout << pModel->vertices[i * 2].pos_offset[1] << ' ';
-    //     // std::cout << pModel->vertices[i * 2].pos_offset[2] << std::endl;
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[0] << ' ';
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[1] << ' ';
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[2] << std::endl;
-    //     std::cout << std::endl;
-    // }
-    // for (int i = 0; i < 100; i++) std::cout << pModel->vertices[i].offset << ' ';
-    // std::cout << std::endl;
-    
-    // for (int i = 0; i < 100; i++) std::cout << pModel->adjacency[i] << ' ';
-    // std::cout << std::endl;
 }
 
 void AABBTree::buildAABBTree()
@@ -233,44 +1596,67 @@ void AABBTree::buildAABBTree()
                              0, 1, &barrier, 0, nullptr, 0, nullptr);
     }
     context.endSingleTimeCommands(cmd);
+}
+
+void AABBTree::buildOnHost()
+{
+    uint32_t numVertices = static_cast<uint32_t>(pModel->getNumVertices());
+    leafOrder.resize(numVertices);
+    orderBuffer->downloadData(leafOrder.data(), leafOrder.size() * sizeof(uint32_t));
+    aabbTree.resize(size_t(1) << numLevels);
 
-    // std::vector<AABB> tmp(1u << numLevels);
-    // aabbBuffer->downloadData(tmp.data(), aabbBuffer->getSize());
-
-    // int x = 2097152;
-    // // int x = 1048576 + 3;
-    // std::cout << x << std::endl;
-    // for (int i = x - 5; i < x; i++)
-    // {
-    //     std::cout << tmp[i].min[0] << ' ';
-    //     std::cout << tmp[i].min[1] << ' ';
-    //     std::cout << tmp[i].min[2] << std::endl;
-    //     std::cout << tmp[i].max[0] << ' ';
-    //     std::cout << tmp[i].max[1] << ' ';
-    //     std::cout << tmp[i].max[2] << std::endl;
-    //     // std::cout << pModel->vertices[i * 2].pos_offset[0] << ' ';
-    //     // std::cout << pModel->vertices[i * 2].pos_offset[1] << ' ';
-    //     // std::cout << pModel->vertices[i * 2].pos_offset[2] << std::endl;
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[0] << ' ';
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[1] << ' ';
-    //     // std::cout << pModel->vertices[i * 2 + 1].pos_offset[2] << std::endl;
-    //     std::cout << std::endl;
-    // }
+    // As build_leaves.comp: every leaf bounds two consecutive points of the order
+    parallelFor(size_t(1) << (numLevels - 1), [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::vec3 a = pModel->getPosition(leafOrder[std::min<size_t>(2 * i, numVertices - 1)]);
+            glm::vec3 b = pModel->getPosition(leafOrder[std::min<size_t>(2 * i + 1, numVertices - 1)]);
+            aabbTree[i] = {glm::min(a, b), glm::max(a, b)};
+        } }, 1 << 16);
+
+    // As build_tree.comp: every level from the one below it, towards the root
+    for (uint32_t level = numLevels - 1; level-- > 0;)
+    {
+        size_t numNodes = size_t(1) << level;
+        size_t offset = (size_t(1) << numLevels) - (size_t(1) << (level + 1));
+        size_t children = offset - 2 * numNodes;
+        parallelFor(numNodes, [&](size_t begin, size_t end)
+                    {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto &left = aabbTree[children + 2 * i];
+                auto &right = aabbTree[children + 2 * i + 1];
+                aabbTree[offset + i] = {glm::min(left.min, right.min), glm::max(left.max, right.max)};
+            } }, 1 << 16);
+    }
+}
+
+void AABBTree::releaseHostData()
+{
+    std::vector<AABB>().swap(aabbTree);
+    std::vector<uint32_t>().swap(leafOrder);
 }
 
 void AABBTree::downloadAABBTree()
 {
     aabbTree.resize(1 << numLevels);
     aabbBuffer->downloadData(aabbTree.data(), aabbBuffer->getSize());
+    leafOrder.resize(pModel->getNumVertices());
+    orderBuffer->downloadData(leafOrder.data(), leafOrder.size() * sizeof(uint32_t));
 }
 
 uint32_t AABBTree::nearestNeighbor(glm::vec3 &pos)
 {
-//     auto printVec3 = [](auto &a)
-//     {
-//         std::cout << a[0] << ' ' << a[1] << ' ' << a[2] << std::endl;
-//     };
-    // auto distance2Node = [&printVec3](AABBTree::AABB &node, glm::vec3 &p) -> float
+    uint64_t nodesVisited = 0;
+    return findNearest(pos, nodesVisited);
+}
+
+uint32_t AABBTree::findNearest(glm::vec3 &pos, uint64_t &nodesVisited)
+{
+    if (aabbTree.empty())
+        return pModel->nearestPosition(pos);
+
     auto distance2Node = [](AABBTree::AABB &node, glm::vec3 &p) -> float
     {
         glm::vec3 d = glm::max(glm::max(node.min - p, glm::vec3(0)), p - node.max);
@@ -291,7 +1677,7 @@ uint32_t AABBTree::nearestNeighbor(glm::vec3 &pos)
 
         auto level_start = ((1 << numLevels) - (1 << level + 1));
         auto node_idx = (level_start + idx);
-        // std::cout << "DFS: " << node_idx << ' ' << level << std::endl;
+        nodesVisited++;
 
         if (level == numLevels - 1)
         {
@@ -300,9 +1686,9 @@ uint32_t AABBTree::nearestNeighbor(glm::vec3 &pos)
             for (uint32_t i = 0; i < 2; ++i)
             {
                 uint32_t pointIdx = point_start_idx + i;
-                pointIdx = std::min(pointIdx, pModel->getNumVertices() - 1);
+                pointIdx = leafOrder[std::min<size_t>(pointIdx, pModel->getNumVertices() - 1)];
 
-                auto point = glm::vec3(pModel->getVertices()[pointIdx].pos);
+                auto point = pModel->getPosition(pointIdx);
 
                 float dist = glm::length(pos - point);
 
@@ -321,7 +1707,6 @@ uint32_t AABBTree::nearestNeighbor(glm::vec3 &pos)
 
     for (;;) {
         auto action = check(current_node, current_depth);
-        // std::cout << "action: " << action << std::endl;
         if (action == 0 &&
                    current_depth != numLevels - 1) {
             current_node = 2 * current_node;
@@ -5,44 +5,260 @@
 #include "vulkan_context.h"
 #include "compute_pipeline.hpp"
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <array>
+#include <functional>
 #include <memory>
 #include <vector>
 #include "buffer.hpp"
+#include "platform.hpp"
+#include "ply.hpp"
+#include "scene_cache.hpp"
+
+class RadFoamPly;
 
 class RadFoam
 {
 public:
-    struct RadFoamVertex
+    // GPU layout is split by access pattern: the face loop reads only the dense vec4 position
+    // stream, each step reads its cell record once, and SH are read only when a sample is shaded.
+    // Adjacency offsets hold the low 32 bits; beyond 2^32 entries the high word of a cell's
+    // offsets is the number of adjacency wraps at or before it, see findAdjacencyWraps
+    struct RadFoamCell
     {
-        alignas(16) glm::vec4 pos;
         float density;
-        uint32_t offset;
-        alignas(16) std::array<float, 48> sh_coeffs;
+        uint32_t adjacencyBegin;
+        uint32_t adjacencyEnd;
     };
 
-    static_assert(sizeof(RadFoamVertex) == 56 * sizeof(float), "RadFoamVertex size mismatch");
+    static_assert(sizeof(RadFoamCell) == 3 * sizeof(float), "RadFoamCell size mismatch");
+
+    // 64-bit offset of a low word at or after previous, for ranges of less than 2^32 entries
+    static uint64_t extendOffset(uint64_t previous, uint32_t low)
+    {
+        return previous + static_cast<uint32_t>(low - static_cast<uint32_t>(previous));
+    }
+    // Cells whose adjacency offsets wrap past a multiple of 2^32, in the ray tracer's uniform
+    static constexpr uint32_t maxAdjacencyWraps = 4;
+    // Continues a scan of contiguous cell records: end holds the 64-bit end of the cell before
+    // firstCell, wraps receives every cell whose range starts in a further 2^32 entries
+    static void scanAdjacencyWraps(const RadFoamCell *cells, size_t firstCell, size_t count, uint64_t &end,
+                                   std::vector<uint32_t> &wraps);
+
+    // SH representation the loaders write: the source bands up to degree, as float32 or float16.
+    // Every batch is converted on the host before staging, so the source SH never reach the device.
+    struct ShFormat
+    {
+        uint32_t degree;
+        bool half;
+    };
+    // Called with the counts of the scene header before any buffer is created
+    using ShFormatChooser = std::function<ShFormat(size_t numCells, size_t numAdjacency, uint32_t shDegree)>;
 
-    explicit RadFoam(std::shared_ptr<RadFoamVulkanArgs> pArgs);
+    explicit RadFoam(std::shared_ptr<RadFoamVulkanArgs> pArgs, ShFormatChooser chooseShFormat = nullptr);
 
     auto getNumVertices() { return this->numVertices; }
     auto getNumAdjacency() { return this->numAdjacency; }
-    auto getVertexBuffer() { return vertexBuffer; }
+    auto getShDegree() { return this->shDegree; }
+    auto getNumShCoeffs() { return this->numShCoeffs; }
+    auto getPositionBuffer() { return positionBuffer; }
+    uint32_t getPositionBits() const { return positionBits; }
+    auto getPositionBlockBuffer() { return positionBlockBuffer; }
+    auto getCellBuffer() { return cellBuffer; }
+    auto getShBuffer() { return shBuffer; }
+    bool isShHalf() const { return shHalf; }
+    // The cache, pack and LOD files hold the source SH, so they are not written from other ones
+    bool hasSourceSh() const { return !shHalf && shDegree == sourceShDegree; }
+    uint32_t getSourceShDegree() const { return sourceShDegree; }
     auto getAdjacencyBuffer() { return adjacencyBuffer; }
-    auto &getVertices() { return vertices; }
+    auto getFacePlaneBuffer() { return facePlaneBuffer; }
+    uint32_t getAdjacencyStride() const { return adjacencyStride; }
+    auto getPaddedAdjacencyBuffer() { return paddedAdjacencyBuffer; }
+    bool isDeltaAdjacency() const { return deltaOverflowBuffer != nullptr; }
+    bool hasSharedFaces() const { return faceCellBuffer != nullptr; }
+    auto getFaceCellBuffer() { return faceCellBuffer; }
+    auto getDeltaOverflowBuffer() { return deltaOverflowBuffer; }
+    auto &getPositions() { return positions; }
+    glm::vec3 getPosition(uint32_t index) const;
+    auto getCache() { return pCache; }
+    void releaseCache() { pCache.reset(); }
+    // First cell of every further 2^32 adjacency entries, empty for smaller scenes
+    const auto &getAdjacencyWraps() const { return adjacencyWraps; }
+    // Host passes that walk the adjacency with 32-bit offsets call this first
+    void requireAdjacency32(const std::string &pass) const;
+
+    // Low-memory mode: keep only what CPU queries need, optionally as 16-bit positions
+    void compactHostData(bool quantize);
+    size_t getHostDataSize() const;
+    // Device memory of every buffer the scene holds, including copies kept for reports
+    size_t getDeviceMemorySize() const;
+    // Cells in the device streams: coarse LOD cells and their adjacency may follow the scene's own,
+    // so passes over the streams take counts from the buffers rather than numVertices and numAdjacency
+    size_t getNumStoredCells() const { return cellBuffer->getSize() / sizeof(RadFoamCell); }
+    // Brute-force nearest cell, used once the AABB tree has been released
+    uint32_t nearestPosition(const glm::vec3 &pos) const;
+
+    // Largest range of one storage buffer binding. Passes split what they can over ranges of this
+    // size; buffers they must bind whole are checked first, so oversized scenes fail with their name
+    static VkDeviceSize getMaxBindingRange();
+    static void checkBindingRange(const std::shared_ptr<Buffer> &buffer, const std::string &name);
+
+    // Half-precision SH: pairs of float16 per word, every cell padded to a whole word
+    static uint32_t getShHalfWords(uint32_t numShCoeffs) { return (numShCoeffs + 1) / 2; }
+    // The source cells are srcStride floats apart, so the leading coefficients of wider SH can be packed
+    static void packShHalf(const float *src, size_t count, uint32_t numShCoeffs, uint32_t *dst, uint32_t srcStride);
+    static void unpackShHalf(const uint32_t *src, size_t count, uint32_t numShCoeffs, float *dst);
+    // Replaces the SH buffer by its float16 version on the GPU, keeping the float32 one on request
+    void convertShToHalf(bool keepFloat);
+    auto getFloatShBuffer() { return floatShBuffer; }
+
+    // Variable-length SH: every cell keeps the bands up to the last one whose energy (sum of
+    // squared coefficients) exceeds bandEnergy; cells with zero density or density <= minDensity
+    // store none and the shader treats them as empty. The float32 coefficients are packed back to back; the index
+    // buffer holds offset << 3 | degree per cell, noShStorage for none. keepFloat leaves the
+    // float32 SH for quality reports.
+    static constexpr uint32_t noShStorage = 4;
+    void packVariableSh(float bandEnergy, float minDensity, bool keepFloat);
+    bool isShVariable() const { return shIndexBuffer != nullptr; }
+    auto getShIndexBuffer() { return shIndexBuffer; }
+    void releaseFloatSh() { floatShBuffer.reset(); }
+
+    // One plane per adjacency entry (glm::vec4: normal towards the neighbour, offset), so the
+    // ray tracer tests a face without fetching the neighbour's position
+    void buildFacePlanes();
+
+    // Shared faces: every Voronoi face once in a face table holding its two cells (glm::ivec2), and
+    // with planes its plane from the first cell towards the second in the face plane buffer. The
+    // adjacency entries become face id << 1, with bit 0 set when the cell is the face's second one.
+    // A neighbour that does not list the cell back gets a face of its own.
+    void buildSharedFaces(bool planes);
+
+    // Fixed-stride adjacency: the first adjacencyStride neighbours of every cell in a padded block
+    // (-1 past the valence), the rest in an overflow list that takes over the CSR buffers. The
+    // stride covers most cells of the valence histogram. keepCsr retains the CSR buffers for reports.
+    static constexpr double paddedAdjacencyCoverage = 0.95;
+    void buildPaddedAdjacency(bool keepCsr);
+    auto getCsrCellBuffer() { return csrCellBuffer; }
+    auto getCsrAdjacencyBuffer() { return csrAdjacencyBuffer; }
+    void releaseCsr() { csrCellBuffer.reset(), csrAdjacencyBuffer.reset(); }
+
+    // Compact adjacency: 16-bit entries in place of the 32-bit ones, so cell ranges are unchanged.
+    // An entry with bit 0 clear holds the neighbour's signed offset from its cell in the upper 15
+    // bits; with bit 0 set, the upper bits index the far neighbours of the cell's block in an
+    // overflow table that starts with the base of every block. Decoded and checked before upload.
+    static constexpr uint32_t deltaAdjacencyBlockSize = 256;
+    static constexpr int32_t maxAdjacencyDelta = (1 << 14) - 1;
+    void buildDeltaAdjacency();
+
+    // Fixed-point GPU positions: blocks of consecutive cells share an origin and a per-axis step,
+    // every cell stores three codes of up to 21 bits in two words
+    static constexpr uint32_t positionBlockSize = 256;
+    struct PositionBlock
+    {
+        glm::vec4 origin;
+        glm::vec4 step;
+    };
+    // Replaces the position buffer by its quantized version, keeping the float32 one on request
+    void quantizePositionBuffer(uint32_t bits, bool keepFloat);
+    auto getFloatPositionBuffer() { return floatPositionBuffer; }
+    void releaseFloatPositions() { floatPositionBuffer.reset(); }
 
 // private:
-    std::vector<RadFoamVertex> vertices;
-    std::vector<uint32_t> adjacency;
-    std::shared_ptr<Buffer> vertexBuffer;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::u16vec3> quantizedPositions; // Replaces positions after compactHostData(true)
+    glm::vec3 positionBoundsMin;
+    glm::vec3 positionScale;
+    std::shared_ptr<Buffer> positionBuffer; // glm::vec4 per cell, or glm::uvec2 when quantized
+    std::shared_ptr<Buffer> positionBlockBuffer;
+    std::shared_ptr<Buffer> floatPositionBuffer; // float32 copy kept for quality reports
+    uint32_t positionBits = 0;
+    std::shared_ptr<Buffer> cellBuffer;
+    std::shared_ptr<Buffer> shBuffer;      // float32, or packed float16 as loaded or after convertShToHalf()
+    std::shared_ptr<Buffer> floatShBuffer; // float32 copy kept for quality reports
+    std::shared_ptr<Buffer> shIndexBuffer; // Per cell with variable-length SH
     std::shared_ptr<Buffer> adjacencyBuffer;
-    uint32_t numVertices;
-    uint32_t numAdjacency;
+    std::shared_ptr<Buffer> facePlaneBuffer; // Per adjacency entry, or per face with shared faces
+    std::shared_ptr<Buffer> paddedAdjacencyBuffer;
+    std::shared_ptr<Buffer> deltaOverflowBuffer; // Block bases, then far neighbour ids
+    std::shared_ptr<Buffer> faceCellBuffer;
+    std::shared_ptr<Buffer> csrCellBuffer;      // CSR copies kept for quality reports
+    std::shared_ptr<Buffer> csrAdjacencyBuffer;
+    uint32_t adjacencyStride = 0;
+    bool shHalf = false;
+    uint64_t numVertices;
+    uint64_t numAdjacency;
+    std::vector<uint32_t> adjacencyWraps;
+    uint32_t shDegree;
+    uint32_t numShCoeffs; // Floats per cell: 3 * (shDegree + 1)^2
+    uint32_t sourceShDegree;
+    uint32_t sourceNumShCoeffs;
+    ShFormatChooser chooseShFormat;
 
-    void parseHeader(std::istream &is);
-    void parseVertexData(std::istream &is);
-    void parseAdjacencyData(std::istream &is);
-    void uploadRadFoam();
+    std::shared_ptr<SceneCache> pCache; // Set while the scene comes from an .rfcache
+
+    // Device-local storage buffer holding size bytes of data, at least one word
+    static std::shared_ptr<Buffer> createDeviceBuffer(const void *data, size_t size);
+    // Host copies of the CSR cell records and adjacency, every cell's range checked
+    void downloadCsr(std::vector<RadFoamCell> &cells, std::vector<int32_t> &adjacency) const;
+    // Sets the loaded SH format from the source degree, once numVertices and numAdjacency are known
+    void selectShFormat(uint32_t degree);
+    // Bytes of one cell in the loaded SH buffer
+    size_t getShCellSize() const;
+    // Writes count cells of source SH into dst in the loaded format
+    void convertSourceSh(const float *src, size_t count, void *dst) const;
+    void createBuffers(size_t numCells, size_t numAdjacency);
+    // Reads the cell records back to find where the 32-bit adjacency offsets wrap
+    void findAdjacencyWraps();
+    void uploadRadFoam(const RadFoamPly &ply);
+    bool loadFromCache(SceneCache &cache);
+    void loadFromPack(const std::string &path);
+};
+
+// RadFoam PLY decoder producing the GPU layout; needs no device, so tools can reuse it
+class RadFoamPly
+{
+public:
+    // Vertex and adjacency properties resolved from the PLY header
+    struct VertexSchema
+    {
+        size_t stride = 0;
+        PlyProperty x, y, z, density, offset;
+        std::vector<PlyProperty> sh;
+        bool packed = false;  // float32 fields and contiguous SH, decoded with plain copies
+        bool colorDc = false; // sh[0..2] are 8-bit red/green/blue, as in RadFoam's own export
+        PlyProperty adjacency;
+        size_t adjacencyStride = 0;
+    };
+
+    // planarSh: color_sh_N stores each channel's coefficients contiguously instead of per coefficient
+    explicit RadFoamPly(const std::string &path, bool planarSh = false);
+
+    const std::string &getPath() const { return path; }
+    const VertexSchema &getSchema() const { return schema; }
+    uint64_t getNumVertices() const { return numVertices; }
+    uint64_t getNumAdjacency() const { return numAdjacency; }
+    uint32_t getShDegree() const { return shDegree; }
+    uint32_t getNumShCoeffs() const { return numShCoeffs; }
+    size_t getVertexDataOffset() const { return vertexDataOffset; }
+    size_t getAdjacencyDataOffset() const { return adjacencyDataOffset; }
+
+    // Decode count records on all cores into the GPU streams; adjacencyBegin is the low word of
+    // where the first record's neighbours start, hostPositionDst may be null
+    void convertVertexData(const char *src, size_t count, uint32_t adjacencyBegin, glm::vec4 *positionDst,
+                           RadFoam::RadFoamCell *cellDst, float *shDst, glm::vec3 *hostPositionDst) const;
+    // Exclusive end of the neighbours of a record
+    uint32_t getAdjacencyEnd(const char *record) const;
+    void convertAdjacencyData(const char *src, size_t count, uint32_t *dst) const;
+
+private:
+    std::string path;
+    VertexSchema schema;
+    uint64_t numVertices;
+    uint64_t numAdjacency;
+    uint32_t shDegree;
+    uint32_t numShCoeffs;
+    size_t vertexDataOffset;
+    size_t adjacencyDataOffset;
 };
 
 class AABBTree
@@ -62,13 +278,32 @@ public:
 
     AABBTree(std::shared_ptr<RadFoam> pModel);
     uint32_t nearestNeighbor(glm::vec3 &pos);
+    // Frees the host copy of the tree; nearestNeighbor() falls back to a linear scan
+    void releaseHostData();
+    size_t getHostDataSize() const { return aabbTree.capacity() * sizeof(AABB) + leafOrder.capacity() * sizeof(uint32_t); }
+
+    auto getNumLevels() { return numLevels; }
+    auto &getNodes() { return aabbTree; }
+    auto &getLeafOrder() { return leafOrder; }
 
 private:
+    // LBVH order: Morton codes of the points, radix sorted on the GPU, so that every leaf and
+    // subtree covers points close in space rather than close in the input
+    void sortPoints();
+    // Mean node surface area and nodes visited per nearestNeighbor() query
+    void printQuality(double buildMs);
+    // nearestNeighbor() counting the nodes it visits
+    uint32_t findNearest(glm::vec3 &pos, uint64_t &nodesVisited);
     void buildAABBLeaves();
     void buildAABBTree();
     void downloadAABBTree();
+    // Leaves and levels from the sorted order on the host, for trees beyond one binding
+    void buildOnHost();
     std::shared_ptr<RadFoam> pModel;
+    // Only while building; queries run on the host copy of the tree
     std::shared_ptr<Buffer> aabbBuffer;
+    std::shared_ptr<Buffer> orderBuffer;
     std::vector<AABB> aabbTree;
+    std::vector<uint32_t> leafOrder; // Point id of every leaf slot
     uint32_t numLevels;
 };
\ No newline at end of file
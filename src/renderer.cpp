@@ -5,13 +5,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/orthonormalize.hpp>
+#include <algorithm>
+#include <cmath>
 
-Renderer::Renderer(std::shared_ptr<RadFoamVulkanArgs> pArgs,
-                   std::shared_ptr<RadFoam> pModel,
-                   std::shared_ptr<AABBTree> pAABB)
-    : pArgs(pArgs), pModel(pModel), pAABB(pAABB)
+Renderer::Renderer(std::shared_ptr<RadFoamVulkanArgs> pArgs)
+    : pArgs(pArgs)
 {
     auto &context = VulkanContext::getContext();
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = context.getQueueFamilyIndex();
+    ERR_GUARD_VULKAN(vkCreateCommandPool(context.getDevice(), &poolInfo, nullptr, &commandPool));
+
     uniformBuffer = std::make_shared<Buffer>(sizeof(UniformData),
                                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                                              VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
@@ -19,37 +25,256 @@ Renderer::Renderer(std::shared_ptr<RadFoamVulkanArgs> pArgs,
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = context.getCommandPool();
+    allocInfo.commandPool = commandPool;
     allocInfo.commandBufferCount = 1;
     ERR_GUARD_VULKAN(vkAllocateCommandBuffers(context.getDevice(), &allocInfo, &renderCommandBuffer));
 
+    VkQueryPoolCreateInfo queryInfo{};
+    queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = 2;
+    ERR_GUARD_VULKAN(vkCreateQueryPool(context.getDevice(), &queryInfo, nullptr, &timestampPool));
+
     data.R = glm::mat3x4(
         {0.08240976184606552, 0.6311448812484741, -0.771274745464325, 0},
         {-0.6168570518493652, 0.6401463150978088, 0.45793023705482483, 0},
         {0.7827489972114563, 0.43802836537361145, 0.4420804977416992, 0});
     data.T = glm::vec3(-3.1629207134246826, -0.6483269333839417, -0.17025022208690643);
 
-    data.startPoint = pAABB->nearestNeighbor(data.T);
     data.focal_x = 805.67529296875;
     data.focal_y = 805.67529296875;
     data.width = pArgs->windowWidth;
     data.height = pArgs->windowHeight;
     data.maxSteps = 1024;
     data.transmittanceThreshold = 0.001f;
+    data.frameIndex = 1;
+    data.countSteps = 0;
+    data.sceneIndex = 0;
+    data.scene = {};
+    data.scene.positionChunkShift = data.scene.cellChunkShift = data.scene.adjacencyChunkShift = data.scene.shChunkShift = 31;
+    data.scene.facePlaneChunkShift = data.scene.paddedAdjacencyChunkShift = data.scene.faceCellChunkShift =
+        data.scene.shIndexChunkShift = 31;
+    data.scene.adjacencyWraps = glm::ivec4(INT32_MAX);
 
     createRayTracingPipeline();
     createSyncObjects();
 }
 
+Renderer::StreamLayout Renderer::getStreamLayout(VkDeviceSize bufferSize, VkDeviceSize elementSize,
+                                                 VkDeviceSize maxRange)
+{
+    StreamLayout layout{0, 0, 0};
+    while (layout.chunkShift < 31 && (VkDeviceSize(2) << layout.chunkShift) * elementSize <= maxRange)
+        ++layout.chunkShift;
+    layout.chunkSize = (VkDeviceSize(1) << layout.chunkShift) * elementSize;
+    layout.numChunks = (bufferSize + layout.chunkSize - 1) / layout.chunkSize;
+    return layout;
+}
+
+void Renderer::bindStream(uint32_t scene, uint32_t binding, const std::shared_ptr<Buffer> &buffer,
+                          VkDeviceSize elementSize, uint32_t &chunkShift)
+{
+    auto &context = VulkanContext::getContext();
+    auto &limits = context.getPhysicalDeviceProperties().limits;
+
+    auto [shift, chunkSize, numChunks] = getStreamLayout(buffer->getSize(), elementSize, limits.maxStorageBufferRange);
+    chunkShift = shift;
+    uint32_t maxChunks = getMaxChunks(binding);
+    if (numChunks > maxChunks)
+        throw std::runtime_error(std::format("Scene buffer of {}MB exceeds {} bindings of {}MB", buffer->getSize() >> 20,
+                                             maxChunks, chunkSize >> 20));
+    if (numChunks > 1 && (!context.supportsNonUniformStorageIndexing() ||
+                          chunkSize % limits.minStorageBufferOffsetAlignment != 0))
+        throw std::runtime_error(std::format("Scene buffer of {}MB exceeds maxStorageBufferRange and the device cannot "
+                                             "split it over several bindings",
+                                             buffer->getSize() >> 20));
+
+    for (uint32_t c = 0; c < maxChunks; ++c)
+    {
+        uint32_t slot = scene * maxChunks + c;
+        if (c < numChunks)
+            inputSet->bindBuffers(binding, {buffer->getBuffer()}, c * chunkSize,
+                                  std::min(chunkSize, buffer->getSize() - c * chunkSize), slot);
+        else
+            inputSet->bindBuffers(binding, {emptyBuffer->getBuffer()}, 0, VK_WHOLE_SIZE, slot);
+    }
+}
+
+void Renderer::bindSceneBuffer(uint32_t scene, uint32_t binding, const std::shared_ptr<Buffer> &buffer,
+                               const std::string &name)
+{
+    RadFoam::checkBindingRange(buffer, name);
+    inputSet->bindBuffers(binding, {buffer->getBuffer()}, 0, VK_WHOLE_SIZE, scene);
+}
+
+void Renderer::bindPositions(const std::shared_ptr<Buffer> &buffer)
+{
+    bindStream(data.sceneIndex, 1, buffer, 4 * sizeof(uint32_t), data.scene.positionChunkShift);
+}
+
+void Renderer::bindCells(const std::shared_ptr<Buffer> &buffer)
+{
+    bindStream(data.sceneIndex, 2, buffer, sizeof(RadFoam::RadFoamCell), data.scene.cellChunkShift);
+}
+
+void Renderer::bindAdjacency(const std::shared_ptr<Buffer> &buffer)
+{
+    bindStream(data.sceneIndex, 3, buffer, sizeof(uint32_t), data.scene.adjacencyChunkShift);
+}
+
+void Renderer::bindSh(const std::shared_ptr<Buffer> &buffer)
+{
+    bindStream(data.sceneIndex, 4, buffer, sizeof(uint32_t), data.scene.shChunkShift);
+}
+
+void Renderer::setScene(std::shared_ptr<RadFoam> pModel, std::shared_ptr<AABBTree> pAABB,
+                        std::shared_ptr<FoamLod> pLod, std::shared_ptr<ShCodebook> pCodebook)
+{
+    selectScene(addScene(pModel, pAABB, pLod, pCodebook));
+}
+
+uint32_t Renderer::addScene(std::shared_ptr<RadFoam> pModel, std::shared_ptr<AABBTree> pAABB,
+                            std::shared_ptr<FoamLod> pLod, std::shared_ptr<ShCodebook> pCodebook)
+{
+    if (pPagedScene)
+        throw std::runtime_error("A paged scene cannot share the renderer with resident scenes");
+    uint32_t index = 0;
+    while (index < scenes.size() && scenes[index].pModel)
+        ++index;
+    if (index >= maxScenes)
+        throw std::runtime_error(std::format("At most {} scenes can be resident at once", maxScenes));
+
+    // The last frame may still read the descriptor set
+    auto &context = VulkanContext::getContext();
+    vkWaitForFences(context.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+    SceneUniform uniform{};
+    bindStream(index, 1, pModel->getPositionBuffer(), 4 * sizeof(uint32_t), uniform.positionChunkShift);
+    bindStream(index, 2, pModel->getCellBuffer(), sizeof(RadFoam::RadFoamCell), uniform.cellChunkShift);
+    bindStream(index, 3, pModel->getAdjacencyBuffer(), sizeof(uint32_t), uniform.adjacencyChunkShift);
+    bindStream(index, 4, pModel->getShBuffer(), sizeof(uint32_t), uniform.shChunkShift);
+    uniform.facePlaneChunkShift = uniform.paddedAdjacencyChunkShift = uniform.faceCellChunkShift =
+        uniform.shIndexChunkShift = 31;
+    uniform.adjacencyWraps = glm::ivec4(INT32_MAX);
+    auto &wraps = pModel->getAdjacencyWraps();
+    for (glm::length_t w = 0; w < glm::length_t(wraps.size()); ++w)
+        uniform.adjacencyWraps[w] = static_cast<int32_t>(wraps[w]);
+    if (pLod)
+    {
+        bindSceneBuffer(index, 7, pLod->getNodeBuffer(), "LOD nodes");
+        uniform.lodScale = pArgs->lodScale;
+    }
+    if (pCodebook)
+    {
+        bindSceneBuffer(index, 9, pCodebook->getCodebookBuffer(), "SH codebook");
+        uniform.shCodebook = 1;
+    }
+    if (pModel->getPositionBits())
+    {
+        bindSceneBuffer(index, 10, pModel->getPositionBlockBuffer(), "Position blocks");
+        uniform.positionBits = pModel->getPositionBits();
+    }
+    if (pModel->getFacePlaneBuffer())
+    {
+        bindStream(index, 11, pModel->getFacePlaneBuffer(), sizeof(glm::vec4), uniform.facePlaneChunkShift);
+        uniform.facePlanes = 1;
+    }
+    if (pModel->getAdjacencyStride())
+    {
+        bindStream(index, 12, pModel->getPaddedAdjacencyBuffer(), sizeof(int32_t), uniform.paddedAdjacencyChunkShift);
+        uniform.adjacencyStride = pModel->getAdjacencyStride();
+    }
+    if (pModel->isDeltaAdjacency())
+    {
+        bindSceneBuffer(index, 13, pModel->getDeltaOverflowBuffer(), "Delta adjacency overflow");
+        uniform.deltaAdjacency = 1;
+    }
+    if (pModel->hasSharedFaces())
+    {
+        bindStream(index, 14, pModel->getFaceCellBuffer(), sizeof(glm::ivec2), uniform.faceCellChunkShift);
+        uniform.sharedFaces = 1;
+    }
+    if (pModel->isShVariable())
+    {
+        bindStream(index, 15, pModel->getShIndexBuffer(), sizeof(uint32_t), uniform.shIndexChunkShift);
+        uniform.variableSh = 1;
+    }
+    uniform.shDegree = pModel->getShDegree();
+    uniform.shHalf = pModel->isShHalf();
+
+    if (index == scenes.size())
+        scenes.emplace_back();
+    scenes[index] = {pModel, pAABB, pLod, pCodebook, uniform};
+    return index;
+}
+
+void Renderer::removeScene(uint32_t index)
+{
+    if (index >= scenes.size() || !scenes[index].pModel)
+        return;
+    if (index == data.sceneIndex)
+        throw std::runtime_error("The selected scene cannot be removed");
+
+    auto &context = VulkanContext::getContext();
+    vkWaitForFences(context.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+    for (uint32_t binding : streamBindings)
+    {
+        std::vector<VkBuffer> emptyStreams(getMaxChunks(binding), emptyBuffer->getBuffer());
+        inputSet->bindBuffers(binding, emptyStreams, 0, VK_WHOLE_SIZE, index * getMaxChunks(binding));
+    }
+    for (uint32_t binding : sceneBindings)
+        inputSet->bindBuffers(binding, {emptyBuffer->getBuffer()}, 0, VK_WHOLE_SIZE, index);
+    scenes[index] = {};
+}
+
+void Renderer::selectScene(uint32_t index)
+{
+    if (index >= scenes.size() || !scenes[index].pModel)
+        return;
+
+    // The reports work on the selected scene
+    auto &scene = scenes[index];
+    pModel = scene.pModel;
+    pAABB = scene.pAABB;
+    pLod = scene.pLod;
+    pCodebook = scene.pCodebook;
+
+    data.sceneIndex = index;
+    data.scene = scene.uniform;
+    data.scene.startPoint = pAABB->nearestNeighbor(data.T);
+}
+
+void Renderer::setScene(std::shared_ptr<PagedScene> pPagedScene)
+{
+    if (!scenes.empty())
+        throw std::runtime_error("A paged scene cannot share the renderer with resident scenes");
+    this->pPagedScene = pPagedScene;
+
+    bindPositions(pPagedScene->getPositionPool());
+    bindCells(pPagedScene->getCellPool());
+    bindAdjacency(pPagedScene->getAdjacencyPool());
+    bindSh(pPagedScene->getShPool());
+    inputSet->bindBuffers(5, {pPagedScene->getPageTable()->getBuffer()});
+    inputSet->bindBuffers(6, {pPagedScene->getFeedback()->getBuffer()});
+
+    pPagedScene->prefetch(data.T);
+    data.scene.startPoint = pPagedScene->nearestCell(data.T);
+    data.scene.shDegree = pPagedScene->getShDegree();
+    data.scene.shHalf = pPagedScene->isShHalf();
+    data.scene.pageCells = PagedScene::cellsPerPage;
+}
+
 Renderer::~Renderer()
 {
     auto &context = VulkanContext::getContext();
 
-    if (renderCommandBuffer != VK_NULL_HANDLE)
+    if (commandPool != VK_NULL_HANDLE)
     {
-        vkFreeCommandBuffers(context.getDevice(), context.getCommandPool(), 1, &renderCommandBuffer);
+        vkDestroyCommandPool(context.getDevice(), commandPool, nullptr);
     }
 
+    if (timestampPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(context.getDevice(), timestampPool, nullptr);
+
     if (inFlightFence != VK_NULL_HANDLE)
     {
         vkDestroyFence(context.getDevice(), inFlightFence, nullptr);
@@ -67,6 +292,10 @@ void Renderer::render()
     vkWaitForFences(context.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
     vkResetFences(context.getDevice(), 1, &inFlightFence);
 
+    // The previous frame is done: stream in the pages it missed
+    if (pPagedScene)
+        pPagedScene->update(data.T, data.frameIndex++);
+
     handleInput();
 
     uint32_t imageIndex;
@@ -210,18 +439,49 @@ void Renderer::handleInput()
 void Renderer::createRayTracingPipeline()
 {
     auto &context = VulkanContext::getContext();
-    auto shader = std::make_shared<Shader>("src/shader/spv/ray_tracing.comp.spv");
+    // Every scene, the first included, is picked from the binding arrays by the uniform's slot
+    if (!context.supportsDynamicStorageIndexing())
+        throw std::runtime_error("The device does not support shaderStorageBufferArrayDynamicIndexing, "
+                                 "which the ray tracing shader needs to pick scene buffers");
+    // Without non-uniform indexing the shader must not even declare it, so streams are read from one range
+    auto shader = std::make_shared<Shader>(context.supportsNonUniformStorageIndexing()
+                                               ? "src/shader/spv/ray_tracing.comp.spv"
+                                               : "src/shader/spv/ray_tracing_uniform.comp.spv");
     auto rgbBufferSize = pArgs->windowHeight * pArgs->windowWidth * sizeof(int);
     // Input Bindings
     std::vector<DescriptorSet::BindingInfo> inputBindings = {
         {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxAdjacencyChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes, VK_SHADER_STAGE_COMPUTE_BIT},
+        {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes, VK_SHADER_STAGE_COMPUTE_BIT},
+        {10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes, VK_SHADER_STAGE_COMPUTE_BIT},
+        {11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {12, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {13, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes, VK_SHADER_STAGE_COMPUTE_BIT},
+        {14, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
+        {15, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxScenes * maxStreamChunks, VK_SHADER_STAGE_COMPUTE_BIT},
     };
-    auto inputSet = std::make_shared<DescriptorSet>(inputBindings);
+    inputSet = std::make_shared<DescriptorSet>(inputBindings);
     inputSet->bindBuffers(0, {uniformBuffer->getBuffer()});
-    inputSet->bindBuffers(1, {pModel->getVertexBuffer()->getBuffer()});
-    inputSet->bindBuffers(2, {pModel->getAdjacencyBuffer()->getBuffer()});
+    // Every slot that no scene fills stays valid for dynamic indexing
+    emptyBuffer = std::make_shared<Buffer>(16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    std::vector<VkBuffer> emptyScenes(maxScenes, emptyBuffer->getBuffer());
+    for (uint32_t binding : streamBindings)
+        inputSet->bindBuffers(binding, std::vector<VkBuffer>(maxScenes * getMaxChunks(binding), emptyBuffer->getBuffer()));
+    inputSet->bindBuffers(5, {emptyBuffer->getBuffer()});
+    inputSet->bindBuffers(6, {emptyBuffer->getBuffer()});
+    for (uint32_t binding : sceneBindings)
+        inputSet->bindBuffers(binding, emptyScenes);
+    statsBuffer = std::make_shared<Buffer>(3 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                           VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+                                           VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, true);
+    inputSet->bindBuffers(8, {statsBuffer->getBuffer()});
 
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts{inputSet->getDescriptorSetLayout()};
     std::vector<std::shared_ptr<DescriptorSet>> outputSets;
@@ -240,6 +500,19 @@ void Renderer::createRayTracingPipeline()
         descriptorSetLayouts.push_back(outputSet->getDescriptorSetLayout());
     }
 
+    // Offscreen target with the same layout for captures
+    captureImage = std::make_shared<Image>(VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+                                           VkExtent3D{pArgs->windowWidth, pArgs->windowHeight, 1},
+                                           VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                           VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    captureReadback = std::make_shared<Buffer>(rgbBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                               VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+                                               VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, true);
+    auto captureSet = std::make_shared<DescriptorSet>(std::vector<DescriptorSet::BindingInfo>{
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}});
+    captureSet->bindImages(0, {captureImage->getView()}, VK_IMAGE_LAYOUT_GENERAL);
+    captureSetIndex = static_cast<uint32_t>(imageCounts) + 1;
+
     // Create Pipeline
     rayTracingPipeline = std::make_shared<ComputePipeline>(shader->shaderModule, descriptorSetLayouts);
     rayTracingPipeline->addDescriptorSet(inputSet);
@@ -247,6 +520,244 @@ void Renderer::createRayTracingPipeline()
     {
         rayTracingPipeline->addDescriptorSet(outputSets[i]);
     }
+    rayTracingPipeline->addDescriptorSet(captureSet);
+}
+
+Renderer::Capture Renderer::capture(bool countSteps)
+{
+    auto &context = VulkanContext::getContext();
+    vkWaitForFences(context.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+
+    data.countSteps = countSteps ? 1 : 0;
+    uniformBuffer->uploadData(&data, sizeof(UniformData));
+    const uint32_t zero[3] = {0, 0, 0};
+    statsBuffer->uploadData(zero, sizeof(zero));
+
+    auto cmd = context.beginSingleTimeCommands();
+    vkCmdResetQueryPool(cmd, timestampPool, 0, 2);
+    VkImageMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .image = captureImage->getImage(),
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    auto numGroups = (pArgs->windowHeight * pArgs->windowWidth + 255) / 256;
+    rayTracingPipeline->bindDescriptorSets(cmd, {0, captureSetIndex});
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+    vkCmdDispatch(cmd, numGroups, 1, 1);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestampPool, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    VkMemoryBarrier statsBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &statsBarrier, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = captureImage->getExtent();
+    vkCmdCopyImageToBuffer(cmd, captureImage->getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           captureReadback->getBuffer(), 1, &region);
+    context.endSingleTimeCommands(cmd);
+
+    Capture result;
+    result.pixels.resize(size_t(pArgs->windowWidth) * pArgs->windowHeight);
+    captureReadback->downloadData(result.pixels.data(), result.pixels.size() * sizeof(uint32_t));
+    uint32_t stats[3];
+    statsBuffer->downloadData(stats, sizeof(stats));
+    result.totalSteps = stats[0];
+    result.maxSteps = stats[1];
+    result.stuckRays = stats[2];
+    uint64_t timestamps[2];
+    ERR_GUARD_VULKAN(vkGetQueryPoolResults(context.getDevice(), timestampPool, 0, 2, sizeof(timestamps), timestamps,
+                                           sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    result.gpuMs = double(timestamps[1] - timestamps[0]) *
+                   context.getPhysicalDeviceProperties().limits.timestampPeriod * 1e-6;
+
+    data.countSteps = 0;
+    return result;
+}
+
+double Renderer::Capture::psnr(const Capture &reference) const
+{
+    double sumSq = 0.0;
+    for (size_t i = 0; i < pixels.size(); ++i)
+        for (int c = 0; c < 3; ++c)
+        {
+            int d = int((pixels[i] >> (8 * c)) & 0xff) - int((reference.pixels[i] >> (8 * c)) & 0xff);
+            sumSq += d * d;
+        }
+    double mse = sumSq / (3.0 * std::max<size_t>(pixels.size(), 1));
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+uint32_t Renderer::Capture::maxError(const Capture &reference) const
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < pixels.size(); ++i)
+        for (int c = 0; c < 3; ++c)
+            result = std::max<uint32_t>(result, std::abs(int((pixels[i] >> (8 * c)) & 0xff) -
+                                                         int((reference.pixels[i] >> (8 * c)) & 0xff)));
+    return result;
+}
+
+void Renderer::reportLod()
+{
+    if (!pLod)
+        return;
+
+    float configuredScale = data.scene.lodScale;
+    data.scene.lodScale = 0.0f;
+    auto reference = capture();
+    double numRays = double(pArgs->windowWidth) * pArgs->windowHeight;
+    std::cout << std::format("LOD report, {} levels: full resolution {:.1f} steps/ray (max {})\n",
+                             pLod->getNumLevels(), reference.totalSteps / numRays, reference.maxSteps);
+
+    std::vector<float> scales = {0.5f, 1.0f, 2.0f, 4.0f};
+    if (std::find(scales.begin(), scales.end(), configuredScale) == scales.end())
+        scales.push_back(configuredScale);
+    for (float scale : scales)
+    {
+        data.scene.lodScale = scale;
+        auto lod = capture();
+        std::cout << std::format("  {:4.1f}px: {:.1f} steps/ray ({:.2f}x fewer, max {}), PSNR {:.1f}dB, max error {}/255{}\n",
+                                 scale, lod.totalSteps / numRays,
+                                 double(reference.totalSteps) / std::max<uint64_t>(lod.totalSteps, 1), lod.maxSteps,
+                                 lod.psnr(reference), lod.maxError(reference),
+                                 scale == configuredScale ? " (active)" : "");
+    }
+    data.scene.lodScale = configuredScale;
+}
+
+void Renderer::reportShCompression()
+{
+    if (!pModel || !pModel->getFloatShBuffer())
+        return;
+
+    auto compressed = capture();
+    uint32_t shHalf = data.scene.shHalf, shCodebook = data.scene.shCodebook, variableSh = data.scene.variableSh;
+    bindSh(pModel->getFloatShBuffer());
+    data.scene.shHalf = 0;
+    data.scene.shCodebook = 0;
+    data.scene.variableSh = 0;
+    auto reference = capture();
+    bindSh(pModel->getShBuffer());
+    data.scene.shHalf = shHalf;
+    data.scene.shCodebook = shCodebook;
+    data.scene.variableSh = variableSh;
+
+    std::cout << std::format("{} SH: PSNR {:.1f}dB, max error {}/255 against float32, {}MB -> {}MB\n",
+                             data.scene.shCodebook ? "Codebook" : data.scene.variableSh ? "Variable-length" : "Half-precision",
+                             compressed.psnr(reference), compressed.maxError(reference),
+                             pModel->getFloatShBuffer()->getSize() >> 20,
+                             (pModel->getShBuffer()->getSize() +
+                              (pCodebook ? pCodebook->getCodebookBuffer()->getSize() : 0) +
+                              (pModel->isShVariable() ? pModel->getShIndexBuffer()->getSize() : 0)) >> 20);
+    pModel->releaseFloatSh();
+}
+
+void Renderer::reportPositionQuantization()
+{
+    if (!pModel || !pModel->getFloatPositionBuffer())
+        return;
+
+    auto quantized = capture();
+    bindPositions(pModel->getFloatPositionBuffer());
+    data.scene.positionBits = 0;
+    auto reference = capture();
+    bindPositions(pModel->getPositionBuffer());
+    data.scene.positionBits = pModel->getPositionBits();
+
+    // Rays that run into maxSteps only with quantized positions point at broken traversal
+    double numRays = double(pArgs->windowWidth) * pArgs->windowHeight;
+    std::cout << std::format("Quantized positions: PSNR {:.1f}dB, max error {}/255 against float32, "
+                             "{:.1f} -> {:.1f} steps/ray, stuck rays {} -> {}\n",
+                             quantized.psnr(reference), quantized.maxError(reference),
+                             reference.totalSteps / numRays, quantized.totalSteps / numRays,
+                             reference.stuckRays, quantized.stuckRays);
+    pModel->releaseFloatPositions();
+}
+
+std::vector<double> Renderer::timeCaptures(uint32_t frames)
+{
+    capture(false);
+    std::vector<double> times(frames);
+    for (auto &ms : times)
+        ms = capture(false).gpuMs;
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+void Renderer::reportFacePlanes()
+{
+    if (!pModel || !pModel->getFacePlaneBuffer())
+        return;
+
+    constexpr uint32_t frames = 32;
+    data.scene.facePlanes = 0;
+    auto reference = capture();
+    double positionsMs = timeCaptures(frames)[frames / 2];
+    data.scene.facePlanes = 1;
+    auto planes = capture();
+    double planesMs = timeCaptures(frames)[frames / 2];
+
+    std::cout << std::format("Face planes: {:.3f}ms -> {:.3f}ms per frame ({:.2f}x) for +{}MB, "
+                             "PSNR {:.1f}dB against neighbour positions\n",
+                             positionsMs, planesMs, positionsMs / std::max(planesMs, 1e-9),
+                             pModel->getFacePlaneBuffer()->getSize() >> 20, planes.psnr(reference));
+}
+
+void Renderer::reportPaddedAdjacency()
+{
+    if (!pModel || !pModel->getCsrCellBuffer())
+        return;
+
+    constexpr uint32_t frames = 32;
+    auto padded = capture();
+    double paddedMs = timeCaptures(frames)[frames / 2];
+    bindCells(pModel->getCsrCellBuffer());
+    bindAdjacency(pModel->getCsrAdjacencyBuffer());
+    data.scene.adjacencyStride = 0;
+    auto csr = capture();
+    double csrMs = timeCaptures(frames)[frames / 2];
+    bindCells(pModel->getCellBuffer());
+    bindAdjacency(pModel->getAdjacencyBuffer());
+    data.scene.adjacencyStride = pModel->getAdjacencyStride();
+
+    std::cout << std::format("Padded adjacency ({} per cell): CSR {:.3f}ms -> {:.3f}ms per frame ({:.2f}x), "
+                             "{} -> {} steps, PSNR {:.1f}dB against CSR\n",
+                             data.scene.adjacencyStride, csrMs, paddedMs, csrMs / std::max(paddedMs, 1e-9),
+                             csr.totalSteps, padded.totalSteps, padded.psnr(csr));
+    pModel->releaseCsr();
+}
+
+void Renderer::benchmark(uint32_t frames)
+{
+    if (frames == 0)
+        return;
+
+    // Step counts come from one extra frame so the atomics do not skew the timing
+    auto counted = capture();
+    auto times = timeCaptures(frames);
+
+    double numRays = double(pArgs->windowWidth) * pArgs->windowHeight;
+    double seconds = times[frames / 2] * 1e-3;
+    std::cout << std::format("Benchmark, {} frames of {}x{}: median {:.3f}ms (min {:.3f}ms), "
+                             "{:.1f} Mrays/s, {:.1f} Msteps/s, {:.1f} steps/ray\n",
+                             frames, pArgs->windowWidth, pArgs->windowHeight, times[frames / 2], times.front(),
+                             numRays / seconds * 1e-6, counted.totalSteps / seconds * 1e-6,
+                             counted.totalSteps / numRays);
 }
 
 void Renderer::createSyncObjects()
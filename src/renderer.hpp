@@ -1,12 +1,47 @@
 #pragma once
 #include "compute_pipeline.hpp"
 #include "radfoam.hpp"
+#include "paged_scene.hpp"
+#include "foam_lod.hpp"
+#include "sh_codebook.hpp"
 
 class GLFWwindow;
 
 class Renderer
 {
 public:
+    // Scenes stay resident side by side, each in its own slot of the binding arrays
+    static constexpr uint32_t maxScenes = 4;
+
+    // Part of the uniform that belongs to one resident scene; selecting a scene copies it in
+    struct SceneUniform
+    {
+        uint32_t startPoint;
+        uint32_t shDegree;
+        uint32_t pageCells; // 0 unless a PagedScene is bound
+        float lodScale; // 0 unless a FoamLod is bound
+        uint32_t shHalf;
+        uint32_t shCodebook; // 0 unless an ShCodebook is bound
+        uint32_t positionBits;
+        uint32_t facePlanes;
+        uint32_t adjacencyStride; // 0 for CSR adjacency
+        uint32_t deltaAdjacency;
+        uint32_t sharedFaces;
+        uint32_t variableSh;
+        uint32_t positionChunkShift; // log2 of the elements per binding, see bindStream
+        uint32_t cellChunkShift;
+        uint32_t adjacencyChunkShift;
+        uint32_t shChunkShift;
+        uint32_t facePlaneChunkShift;
+        uint32_t paddedAdjacencyChunkShift;
+        uint32_t faceCellChunkShift;
+        uint32_t shIndexChunkShift;
+        // First cell of every further 2^32 adjacency entries, INT32_MAX when unused; a cell's
+        // adjacency offsets continue in the high word counted from these, see RadFoam::findAdjacencyWraps
+        alignas(16) glm::ivec4 adjacencyWraps;
+    };
+    static_assert(RadFoam::maxAdjacencyWraps == 4, "adjacencyWraps holds RadFoam::maxAdjacencyWraps cells");
+
     struct UniformData
     {
         alignas(16) glm::mat3x4 R; // Just for memory alignment
@@ -15,21 +50,77 @@ public:
         uint32_t height;
         float focal_x;
         float focal_y;
-        uint32_t startPoint;
         uint32_t maxSteps;
         float transmittanceThreshold;
+        uint32_t frameIndex;
+        uint32_t countSteps;
+        uint32_t sceneIndex;
+        SceneUniform scene; // Flattened in the shader's uniform block
     };
 
-    static_assert(sizeof(UniformData) == 24 * sizeof(int));
+    static_assert(sizeof(UniformData) == 48 * sizeof(int));
     static_assert(offsetof(UniformData, T) == 12 * sizeof(int));
     static_assert(offsetof(UniformData, width) == 15 * sizeof(int));
+    static_assert(offsetof(UniformData, scene) == 24 * sizeof(int));
+
+    // Offscreen frame of the current view with traversal statistics
+    struct Capture
+    {
+        std::vector<uint32_t> pixels; // RGBA8
+        uint64_t totalSteps = 0;
+        uint32_t maxSteps = 0;
+        uint32_t stuckRays = 0; // Stopped by the step limit
+        double gpuMs = 0.0; // Ray tracing dispatch only
+
+        double psnr(const Capture &reference) const;
+        uint32_t maxError(const Capture &reference) const;
+    };
 
-    Renderer(std::shared_ptr<RadFoamVulkanArgs> pArgs,
-             std::shared_ptr<RadFoam> pModel,
-             std::shared_ptr<AABBTree> pAABB);
+    Renderer(std::shared_ptr<RadFoamVulkanArgs> pArgs);
     ~Renderer();
 
+    // Bind the scene buffers; the pipeline itself does not depend on the scene
+    void setScene(std::shared_ptr<RadFoam> pModel, std::shared_ptr<AABBTree> pAABB,
+                  std::shared_ptr<FoamLod> pLod = nullptr, std::shared_ptr<ShCodebook> pCodebook = nullptr);
+    void setScene(std::shared_ptr<PagedScene> pPagedScene);
+    // Binds a further resident scene to the first free slot and returns its index
+    uint32_t addScene(std::shared_ptr<RadFoam> pModel, std::shared_ptr<AABBTree> pAABB,
+                      std::shared_ptr<FoamLod> pLod = nullptr, std::shared_ptr<ShCodebook> pCodebook = nullptr);
+    // Unbinds a scene other than the selected one and drops the renderer's references to it
+    void removeScene(uint32_t index);
+    // Renders the given resident scene from the current view; only the uniform changes
+    void selectScene(uint32_t index);
+    uint32_t getSelectedScene() const { return data.sceneIndex; }
     void render();
+    Capture capture(bool countSteps = true);
+    // Step counts and error of LOD renders against the full-resolution one
+    void reportLod();
+    // PSNR of the compressed SH render against the float32 one, which is released afterwards
+    void reportShCompression();
+    // Error, step counts and stuck rays of quantized positions against float32 ones
+    void reportPositionQuantization();
+    // GPU time with and without face planes, and the memory they take
+    void reportFacePlanes();
+    // GPU time of padded adjacency against CSR, whose buffers are released afterwards
+    void reportPaddedAdjacency();
+    // Rays and traversal steps per second over the given number of offscreen frames
+    void benchmark(uint32_t frames);
+
+    // Scene streams are bound as up to maxStreamChunks consecutive ranges of one buffer, each
+    // within maxStorageBufferRange, in the slots of the given scene; see bindStream. The adjacency
+    // has maxAdjacencyChunks slots, enough to pass 2^32 entries with 2GB ranges.
+    static constexpr uint32_t maxStreamChunks = 4;
+    static constexpr uint32_t maxAdjacencyChunks = 16;
+    static uint32_t getMaxChunks(uint32_t binding) { return binding == 3 ? maxAdjacencyChunks : maxStreamChunks; }
+    // Split of a stream over bindings: the largest power-of-two element count whose range fits
+    // maxRange, and the ranges of that size the buffer needs
+    struct StreamLayout
+    {
+        uint32_t chunkShift;
+        VkDeviceSize chunkSize;
+        VkDeviceSize numChunks;
+    };
+    static StreamLayout getStreamLayout(VkDeviceSize bufferSize, VkDeviceSize elementSize, VkDeviceSize maxRange);
 
 private:
     float moveSpeed = 0.05f;
@@ -38,12 +129,34 @@ private:
     std::shared_ptr<RadFoamVulkanArgs> pArgs;
     std::shared_ptr<RadFoam> pModel;
     std::shared_ptr<AABBTree> pAABB;
+    std::shared_ptr<PagedScene> pPagedScene;
+    std::shared_ptr<FoamLod> pLod;
+    std::shared_ptr<ShCodebook> pCodebook;
 
+    struct ResidentScene
+    {
+        std::shared_ptr<RadFoam> pModel;
+        std::shared_ptr<AABBTree> pAABB;
+        std::shared_ptr<FoamLod> pLod;
+        std::shared_ptr<ShCodebook> pCodebook;
+        SceneUniform uniform;
+    };
+    std::vector<ResidentScene> scenes; // By slot, without a model while free
+
+    // Own pool: the renderer is built while the loader thread records on the context pool
+    VkCommandPool commandPool = VK_NULL_HANDLE;
     VkCommandBuffer renderCommandBuffer = VK_NULL_HANDLE;
 
     std::shared_ptr<Buffer> uniformBuffer;
+    std::shared_ptr<Buffer> emptyBuffer; // Bound to the paging slots of fully resident scenes
+    std::shared_ptr<Buffer> statsBuffer;
+    std::shared_ptr<Image> captureImage;
+    std::shared_ptr<Buffer> captureReadback;
+    uint32_t captureSetIndex = 0;
+    VkQueryPool timestampPool = VK_NULL_HANDLE; // Brackets the capture dispatch
 
     std::shared_ptr<ComputePipeline> rayTracingPipeline;
+    std::shared_ptr<DescriptorSet> inputSet;
 
     VkFence inFlightFence = VK_NULL_HANDLE;
     VkSemaphore imageAvailableSemaphore;
@@ -51,6 +164,24 @@ private:
 
     UniformData data;
 
+    // Sorted GPU times of offscreen frames, after one warm-up frame
+    std::vector<double> timeCaptures(uint32_t frames);
+
+    // Binds a scene stream over the chunk slots of the given scene; chunkShift receives log2 of
+    // the elements per range. Streams that grow with the cells or faces are split this way, the
+    // smaller per-scene tables are bound whole and rejected beyond one binding.
+    static constexpr uint32_t streamBindings[] = {1, 2, 3, 4, 11, 12, 14, 15};
+    static constexpr uint32_t sceneBindings[] = {7, 9, 10, 13};
+    void bindStream(uint32_t scene, uint32_t binding, const std::shared_ptr<Buffer> &buffer,
+                    VkDeviceSize elementSize, uint32_t &chunkShift);
+    void bindSceneBuffer(uint32_t scene, uint32_t binding, const std::shared_ptr<Buffer> &buffer,
+                         const std::string &name);
+    // Of the selected scene, for the reports
+    void bindPositions(const std::shared_ptr<Buffer> &buffer);
+    void bindCells(const std::shared_ptr<Buffer> &buffer);
+    void bindAdjacency(const std::shared_ptr<Buffer> &buffer);
+    void bindSh(const std::shared_ptr<Buffer> &buffer);
+
     void handleInput();
     void updateUniform();
     void createRayTracingPipeline();
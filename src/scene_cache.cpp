@@ -0,0 +1,261 @@
+#include "scene_cache.hpp"
+#include "radfoam.hpp"
+#include "parallel.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    constexpr char cacheMagic[8] = {'R', 'F', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+    uint64_t hashBlock(const char *data, size_t size, uint64_t seed)
+    {
+        uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+        auto mix = [&h](uint64_t word)
+        {
+            h ^= word * 0x9E3779B97F4A7C15ull;
+            h = ((h << 31) | (h >> 33)) * 0xBF58476D1CE4E5B9ull;
+        };
+
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            mix(word);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, data + i, size - i);
+        mix(tail);
+
+        h ^= h >> 29;
+        h *= 0x94D049BB133111EBull;
+        return h ^ (h >> 32);
+    }
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void SceneCache::Hasher::update(const char *data, size_t size)
+{
+    size_t firstBlock = blockHashes.size();
+    size_t numBlocks = (size + blockSize - 1) / blockSize;
+    blockHashes.resize(firstBlock + numBlocks);
+    totalSize += size;
+
+    parallelFor(numBlocks, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+            blockHashes[firstBlock + i] = hashBlock(data + i * blockSize,
+                                                    std::min(blockSize, size - i * blockSize),
+                                                    firstBlock + i); }, 1);
+}
+
+uint64_t SceneCache::Hasher::finish() const
+{
+    return hashBlock(reinterpret_cast<const char *>(blockHashes.data()),
+                     blockHashes.size() * sizeof(uint64_t), totalSize);
+}
+
+uint64_t SceneCache::hash(const void *data, size_t size)
+{
+    Hasher hasher;
+    hasher.update(static_cast<const char *>(data), size);
+    return hasher.finish();
+}
+
+bool SceneCache::writeFile(const std::string &path, const char *what, const void *header, size_t headerSize,
+                           uint64_t &contentHash, size_t payloadOffset,
+                           const std::function<void(std::ostream &)> &writePayload)
+{
+    auto tmpPath = path + ".tmp";
+    std::error_code ec;
+    {
+        std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+        {
+            std::cout << std::format("{} {} not written: cannot open file\n", what, path);
+            return false;
+        }
+        std::vector<char> reserved(payloadOffset, 0);
+        ofs.write(reserved.data(), reserved.size());
+        writePayload(ofs);
+        ofs.close();
+        if (!ofs)
+        {
+            std::cout << std::format("{} {} not written: write failed\n", what, path);
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+    }
+
+    {
+        MappedFile written(tmpPath);
+        contentHash = hash(written.data() + payloadOffset, written.size() - payloadOffset);
+    }
+    {
+        std::fstream fs(tmpPath, std::ios::binary | std::ios::in | std::ios::out);
+        fs.write(static_cast<const char *>(header), headerSize);
+    }
+
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        std::cout << std::format("{} {} not written: {}\n", what, path, ec.message());
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+bool SceneCache::FileCheck::reject(const char *reason) const
+{
+    std::cout << std::format("{} {} ignored: {}\n", what, path, reason);
+    return false;
+}
+
+bool SceneCache::FileCheck::checkPayload(const MappedFile &file, size_t payloadOffset, size_t payloadSize,
+                                         uint64_t contentHash) const
+{
+    if (file.size() != payloadOffset + payloadSize)
+        return reject("truncated");
+    if (hash(file.data() + payloadOffset, payloadSize) != contentHash)
+        return reject("content hash mismatch");
+    return true;
+}
+
+std::string SceneCache::getPath(const RadFoamVulkanArgs &args)
+{
+    if (!args.cachePath.empty())
+        return args.cachePath;
+    return std::filesystem::path(args.scenePath).replace_extension(".rfcache").string();
+}
+
+SceneCache::SourceStamp SceneCache::getSourceStamp(const std::string &scenePath)
+{
+    SourceStamp stamp{};
+    std::error_code ec;
+    stamp.fileSize = std::filesystem::file_size(scenePath, ec);
+    stamp.modifiedTime = std::filesystem::last_write_time(scenePath, ec).time_since_epoch().count();
+
+    std::ifstream ifs(scenePath, std::ios::binary);
+    std::string head(64 * 1024, '\0');
+    ifs.read(head.data(), head.size());
+    head.resize(ifs.gcount());
+    stamp.headerHash = hash(head.data(), std::min(head.size(), head.find("end_header")));
+    return stamp;
+}
+
+std::shared_ptr<SceneCache> SceneCache::open(const RadFoamVulkanArgs &args)
+{
+    auto path = getPath(args);
+    if (args.noCache || !std::filesystem::exists(path))
+        return nullptr;
+
+    FileCheck check("Scene cache", path);
+    std::shared_ptr<SceneCache> cache(new SceneCache(path));
+    auto &header = cache->header;
+    cache->fileSize = std::filesystem::file_size(path);
+    if (cache->fileSize < sectionAlignment)
+        return check.reject("truncated"), nullptr;
+
+    std::ifstream ifs(path, std::ios::binary);
+    ifs.read(reinterpret_cast<char *>(&header), sizeof(Header));
+    if (!check.checkHeader(header, cacheMagic, formatVersion, getSourceStamp(args.scenePath)))
+        return nullptr;
+
+    const size_t expectedSizes[NumSections] = {
+        sizeof(glm::vec4) * header.numVertices,
+        sizeof(RadFoam::RadFoamCell) * header.numVertices,
+        sizeof(float) * 3 * (header.shDegree + 1) * (header.shDegree + 1) * header.numVertices,
+        sizeof(uint32_t) * header.numAdjacency,
+        sizeof(glm::vec3) * header.numVertices,
+        sizeof(AABBTree::AABB) << header.numAABBLevels,
+        sizeof(uint32_t) * header.numVertices,
+    };
+    for (uint32_t i = 0; i < NumSections; ++i)
+    {
+        if (header.sections[i].size != expectedSizes[i])
+            return check.reject("section sizes do not match the header"), nullptr;
+        if (header.sections[i].offset < sectionAlignment ||
+            header.sections[i].offset + header.sections[i].size > cache->fileSize)
+            return check.reject("truncated"), nullptr;
+    }
+
+    return cache;
+}
+
+void SceneCache::save(const RadFoamVulkanArgs &args, RadFoam &model, AABBTree &aabb)
+{
+    if (args.noCache)
+        return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto path = getPath(args);
+
+    Header header{};
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = formatVersion;
+    header.shDegree = model.getShDegree();
+    header.numVertices = model.getNumVertices();
+    header.numAdjacency = model.getNumAdjacency();
+    header.numAABBLevels = aabb.getNumLevels();
+    header.source = getSourceStamp(args.scenePath);
+
+    // Sections start on page boundaries after the header page
+    size_t offset = sectionAlignment;
+    auto writePayload = [&](std::ostream &ofs)
+    {
+        std::vector<char> chunk(sectionAlignment, 0);
+        auto pad = [&]()
+        {
+            size_t padded = alignUp(offset, sectionAlignment);
+            std::fill(chunk.begin(), chunk.end(), 0);
+            ofs.write(chunk.data(), padded - offset);
+            offset = padded;
+        };
+
+        auto writeHost = [&](SectionId id, const void *data, size_t size)
+        {
+            header.sections[id] = {offset, size};
+            ofs.write(static_cast<const char *>(data), size);
+            offset += size;
+            pad();
+        };
+
+        auto writeBuffer = [&](SectionId id, Buffer &buffer)
+        {
+            constexpr VkDeviceSize chunkSize = 64 << 20;
+            header.sections[id] = {offset, buffer.getSize()};
+            for (VkDeviceSize pos = 0; pos < buffer.getSize(); pos += chunkSize)
+            {
+                auto size = std::min(chunkSize, buffer.getSize() - pos);
+                chunk.resize(size);
+                buffer.downloadData(chunk.data(), size, pos);
+                ofs.write(chunk.data(), size);
+            }
+            offset += buffer.getSize();
+            chunk.resize(sectionAlignment);
+            pad();
+        };
+
+        writeBuffer(PositionStream, *model.getPositionBuffer());
+        writeBuffer(Cells, *model.getCellBuffer());
+        writeBuffer(SphericalHarmonics, *model.getShBuffer());
+        writeBuffer(Adjacency, *model.getAdjacencyBuffer());
+        writeHost(Positions, model.getPositions().data(), sizeof(glm::vec3) * model.getPositions().size());
+        writeHost(AABBs, aabb.getNodes().data(), sizeof(AABBTree::AABB) * aabb.getNodes().size());
+        writeHost(AABBOrder, aabb.getLeafOrder().data(), sizeof(uint32_t) * aabb.getLeafOrder().size());
+    };
+    if (!writeFile(path, "Scene cache", header, sectionAlignment, writePayload))
+        return;
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << std::format("Scene cache written to {}: {}MB, {}ms\n", path, offset >> 20,
+                             std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count());
+}
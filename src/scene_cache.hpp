@@ -0,0 +1,146 @@
+#pragma once
+#include "arguments.hpp"
+#include "platform.hpp"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class RadFoam;
+class AABBTree;
+
+// Versioned on-disk copy of the scene's GPU buffers (.rfcache), keyed by the source PLY
+class SceneCache
+{
+public:
+    static constexpr uint32_t formatVersion = 3;
+    static constexpr size_t sectionAlignment = 4096;
+
+    enum SectionId : uint32_t
+    {
+        PositionStream, // GPU vec4 positions
+        Cells,
+        SphericalHarmonics,
+        Adjacency,
+        Positions, // Host vec3 positions
+        AABBs,
+        AABBOrder, // Point id of every AABB tree leaf slot
+        NumSections
+    };
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Identifies the PLY the cache was built from
+    struct SourceStamp
+    {
+        uint64_t fileSize;
+        int64_t modifiedTime;
+        uint64_t headerHash;
+
+        bool operator==(const SourceStamp &) const = default;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t shDegree;
+        uint64_t numVertices;
+        uint64_t numAdjacency;
+        uint32_t numAABBLevels;
+        uint32_t reserved;
+        SourceStamp source;
+        uint64_t contentHash; // Hash of everything after the header
+        Section sections[NumSections];
+    };
+
+    // Content hash over fixed 1 MB blocks, so that it can be computed chunk by chunk while streaming
+    class Hasher
+    {
+    public:
+        static constexpr size_t blockSize = 1 << 20;
+
+        // Every call but the last must pass a multiple of blockSize
+        void update(const char *data, size_t size);
+        uint64_t finish() const;
+
+    private:
+        std::vector<uint64_t> blockHashes;
+        size_t totalSize = 0;
+    };
+
+    // Reads and checks the header; returns nullptr when the cache is missing, stale or invalid.
+    // The payload hash is verified by whoever streams the sections.
+    static std::shared_ptr<SceneCache> open(const RadFoamVulkanArgs &args);
+    static void save(const RadFoamVulkanArgs &args, RadFoam &model, AABBTree &aabb);
+
+    static std::string getPath(const RadFoamVulkanArgs &args);
+    static SourceStamp getSourceStamp(const std::string &scenePath);
+    static uint64_t hash(const void *data, size_t size);
+
+    // The files written next to the scene (.rfcache, .rflod, .rfvq) share a header that starts with
+    // magic, version and source, and a contentHash of everything after it.
+
+    // Writes <path>.tmp: payloadOffset bytes reserved for the header, then writePayload. The header
+    // gets the hash of the payload read back from the mapped file, and the file is renamed into
+    // place. what names the file in the message printed on failure.
+    template <typename Header>
+    static bool writeFile(const std::string &path, const char *what, Header &header, size_t payloadOffset,
+                          const std::function<void(std::ostream &)> &writePayload)
+    {
+        return writeFile(path, what, &header, sizeof(Header), header.contentHash, payloadOffset, writePayload);
+    }
+
+    // Checks a file being loaded, printing "<what> <path> ignored: <reason>" on the first mismatch
+    class FileCheck
+    {
+    public:
+        FileCheck(const char *what, const std::string &path) : what(what), path(path) {}
+
+        // Always false
+        bool reject(const char *reason) const;
+        template <typename Header>
+        bool checkHeader(const Header &stored, const char (&magic)[8], uint32_t version,
+                         const SourceStamp &source) const
+        {
+            if (std::memcmp(stored.magic, magic, sizeof(magic)) != 0)
+                return reject("unrecognized file type");
+            if (stored.version != version)
+                return reject("format version mismatch");
+            if (!(stored.source == source))
+                return reject("source scene changed");
+            return true;
+        }
+        // The file holds exactly payloadSize bytes after payloadOffset, matching contentHash
+        bool checkPayload(const MappedFile &file, size_t payloadOffset, size_t payloadSize, uint64_t contentHash) const;
+
+    private:
+        const char *what;
+        const std::string &path;
+    };
+
+    const std::string &getFilePath() const { return path; }
+    size_t getFileSize() const { return fileSize; }
+    const Header &getHeader() const { return header; }
+    const Section &getSection(SectionId id) const { return header.sections[id]; }
+    // Sections kept in host memory after loading (AABBs, AABBOrder)
+    std::vector<char> &getHostSection(SectionId id) { return hostSections[id]; }
+
+private:
+    explicit SceneCache(const std::string &path) : path(path) {}
+    static bool writeFile(const std::string &path, const char *what, const void *header, size_t headerSize,
+                          uint64_t &contentHash, size_t payloadOffset,
+                          const std::function<void(std::ostream &)> &writePayload);
+
+    std::string path;
+    size_t fileSize = 0;
+    Header header;
+    std::vector<char> hostSections[NumSections];
+};
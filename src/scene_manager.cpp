@@ -0,0 +1,173 @@
+#include "scene_manager.hpp"
+#include <algorithm>
+
+SceneManager::SceneManager(std::shared_ptr<Renderer> pRenderer, size_t budget, Loader loader)
+    : pRenderer(pRenderer), budget(budget), loader(std::move(loader))
+{
+}
+
+size_t SceneManager::getDeviceMemorySize(const Scene &scene)
+{
+    size_t total = scene.pModel->getDeviceMemorySize();
+    if (scene.pLod)
+        total += scene.pLod->getNodeBuffer()->getAllocationSize();
+    if (scene.pCodebook)
+        total += scene.pCodebook->getCodebookBuffer()->getAllocationSize();
+    return total;
+}
+
+std::list<SceneManager::Entry>::iterator SceneManager::find(const std::string &path)
+{
+    return std::find_if(entries.begin(), entries.end(), [&path](const Entry &entry)
+                        { return entry.path == path; });
+}
+
+bool SceneManager::isResident(const std::string &path) const
+{
+    return std::any_of(entries.begin(), entries.end(), [&path](const Entry &entry)
+                       { return entry.path == path; });
+}
+
+size_t SceneManager::getResidentSize() const
+{
+    size_t total = 0;
+    for (auto &entry : entries)
+        total += getDeviceMemorySize(entry.scene);
+    return total;
+}
+
+void SceneManager::makeRoom(size_t size)
+{
+    while (entries.size() >= Renderer::maxScenes || (budget > 0 && getResidentSize() + size > budget))
+    {
+        auto victim = std::find_if(entries.rbegin(), entries.rend(), [this](const Entry &entry)
+                                   { return entry.path != selected; });
+        if (victim == entries.rend())
+            return;
+        evict(std::next(victim).base());
+    }
+}
+
+size_t SceneManager::getLoadSize(const std::string &path, size_t projected) const
+{
+    auto known = knownSizes.find(path);
+    return known != knownSizes.end() ? known->second : projected;
+}
+
+bool SceneManager::fits(size_t size) const
+{
+    return entries.size() < Renderer::maxScenes && (budget == 0 || getResidentSize() + size <= budget);
+}
+
+void SceneManager::evict(std::list<Entry>::iterator it)
+{
+    size_t size = getDeviceMemorySize(it->scene);
+    knownSizes[it->path] = size;
+    pRenderer->removeScene(it->slot);
+    std::cout << std::format("Scene {} evicted, {}MB\n", it->path, size >> 20);
+    entries.erase(it);
+    stats.evictions++;
+}
+
+uint32_t SceneManager::insert(const std::string &path, const Scene &scene)
+{
+    size_t size = getDeviceMemorySize(scene);
+    knownSizes[path] = size;
+    // A scene larger than the budget on its own still loads, next to the one on screen
+    makeRoom(size);
+    uint32_t slot = pRenderer->addScene(scene.pModel, scene.pAABB, scene.pLod, scene.pCodebook);
+    entries.push_front({path, scene, slot});
+    std::cout << std::format("Scene {} resident, {}MB; {} scenes in {}MB{}\n", path, size >> 20, entries.size(),
+                             getResidentSize() >> 20,
+                             budget > 0 ? std::format(" of {}MB", budget >> 20) : std::string());
+    return slot;
+}
+
+void SceneManager::adopt(const std::string &path, const Scene &scene)
+{
+    if (isResident(path))
+        throw std::runtime_error("Scene is already resident: " + path);
+    insert(path, scene);
+}
+
+uint32_t SceneManager::load(const std::string &path)
+{
+    auto it = find(path);
+    if (it != entries.end())
+    {
+        stats.hits++;
+        entries.splice(entries.begin(), entries, it);
+        return it->slot;
+    }
+
+    stats.misses++;
+    // Space is made before the loader allocates anything
+    auto reserve = [&](size_t projected)
+    { makeRoom(getLoadSize(path, projected)); };
+    return insert(path, loader(path, reserve));
+}
+
+void SceneManager::select(const std::string &path)
+{
+    if (path == selected)
+        return;
+    uint32_t slot = load(path);
+    pRenderer->selectScene(slot);
+    selected = path;
+}
+
+void SceneManager::prefetch(const std::string &path)
+{
+    if (isResident(path))
+        return;
+    if (entries.size() >= Renderer::maxScenes)
+    {
+        std::cout << std::format("Prefetch of {} skipped: every scene slot is taken\n", path);
+        return;
+    }
+    // The loader stops at the header when the projected scene does not fit
+    struct NoRoom
+    {
+        size_t size;
+    };
+    auto reserve = [&](size_t projected)
+    {
+        size_t size = getLoadSize(path, projected);
+        if (!fits(size))
+            throw NoRoom{size};
+    };
+    try
+    {
+        auto scene = loader(path, reserve);
+        // The projection leaves out some transforms, so the scene is dropped rather than evict others
+        size_t size = getDeviceMemorySize(scene);
+        knownSizes[path] = size;
+        if (!fits(size))
+            throw NoRoom{size};
+        stats.prefetches++;
+        insert(path, scene);
+    }
+    catch (const NoRoom &noRoom)
+    {
+        std::cout << std::format("Prefetch of {} skipped: {}MB do not fit the {}MB budget next to {}MB resident\n",
+                                 path, noRoom.size >> 20, budget >> 20, getResidentSize() >> 20);
+    }
+}
+
+void SceneManager::evict(const std::string &path)
+{
+    if (path == selected)
+        throw std::runtime_error("The scene on screen cannot be evicted: " + path);
+    auto it = find(path);
+    if (it != entries.end())
+        evict(it);
+}
+
+void SceneManager::printStats() const
+{
+    uint64_t requests = stats.hits + stats.misses;
+    std::cout << std::format("Scene residency: {} hits, {} misses ({:.1f}% hit rate), {} prefetches, {} evictions, "
+                             "{} scenes in {}MB\n",
+                             stats.hits, stats.misses, requests ? 100.0 * stats.hits / requests : 0.0,
+                             stats.prefetches, stats.evictions, entries.size(), getResidentSize() >> 20);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "renderer.hpp"
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+
+// Fully resident scenes loaded on demand into the renderer's scene slots. The device memory VMA
+// holds for them is kept within a budget by evicting the least recently used ones; the scene on
+// screen always stays. An evicted scene reloads from the .rfcache, .rflod and .rfvq files its
+// first load wrote, so only the upload and the GPU transforms run again.
+class SceneManager
+{
+public:
+    struct Scene
+    {
+        std::shared_ptr<RadFoam> pModel;
+        std::shared_ptr<AABBTree> pAABB;
+        std::shared_ptr<FoamLod> pLod;
+        std::shared_ptr<ShCodebook> pCodebook;
+    };
+    // Called by the loader with the projected device memory of the scene once its header is read,
+    // before any of its buffers is created
+    using Reserve = std::function<void(size_t size)>;
+    using Loader = std::function<Scene(const std::string &path, const Reserve &reserve)>;
+
+    struct Stats
+    {
+        uint64_t hits = 0;       // Selections and loads of resident scenes
+        uint64_t misses = 0;     // Selections and loads that had to load the scene
+        uint64_t prefetches = 0; // Loads ahead of use
+        uint64_t evictions = 0;
+    };
+
+    // budget in bytes, 0 leaves only the renderer's slot count as the limit
+    SceneManager(std::shared_ptr<Renderer> pRenderer, size_t budget, Loader loader);
+
+    // Takes over a scene loaded elsewhere, e.g. at startup
+    void adopt(const std::string &path, const Scene &scene);
+    // Makes the scene resident and renders it
+    void select(const std::string &path);
+    // Makes the scene resident without rendering it and returns its renderer slot
+    uint32_t load(const std::string &path);
+    // Loads the scene ahead of use unless it is resident; not counted as a hit or miss. Never evicts:
+    // skipped when no renderer slot or not enough of the budget is free.
+    void prefetch(const std::string &path);
+    // Frees the scene's device memory; the scene on screen cannot be evicted
+    void evict(const std::string &path);
+
+    bool isResident(const std::string &path) const;
+    // Measured on every call, as reports release the copies they compared against
+    size_t getResidentSize() const;
+    const Stats &getStats() const { return stats; }
+    void printStats() const;
+
+    static size_t getDeviceMemorySize(const Scene &scene);
+
+private:
+    struct Entry
+    {
+        std::string path;
+        Scene scene;
+        uint32_t slot;
+    };
+
+    std::list<Entry>::iterator find(const std::string &path);
+    uint32_t insert(const std::string &path, const Scene &scene);
+    // Evicts least recently used scenes other than the one on screen until size more bytes and
+    // one more scene fit, or only that one is left
+    void makeRoom(size_t size);
+    // Device memory a load has to make room for: the size of its last residency, or else the projection
+    size_t getLoadSize(const std::string &path, size_t projected) const;
+    bool fits(size_t size) const;
+    void evict(std::list<Entry>::iterator it);
+
+    std::shared_ptr<Renderer> pRenderer;
+    size_t budget;
+    Loader loader;
+    std::list<Entry> entries; // Most recently used first
+    std::map<std::string, size_t> knownSizes; // Device memory of every scene when it was last resident
+    std::string selected;
+    Stats stats;
+};
@@ -0,0 +1,432 @@
+#include "scene_pack.hpp"
+#include "parallel.hpp"
+#include <glm/gtc/packing.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+    using RadFoamCell = RadFoam::RadFoamCell;
+
+    constexpr char packMagic[8] = {'R', 'F', 'P', 'A', 'C', 'K', '\0', '\0'};
+    constexpr uint64_t positionMax = (1ull << ScenePack::positionBits) - 1;
+
+    void writeVarint(std::vector<char> &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool readVarint(const char *&src, const char *end, uint64_t &value)
+    {
+        value = 0;
+        for (uint32_t shift = 0; shift < 64 && src < end; shift += 7)
+        {
+            uint8_t byte = static_cast<uint8_t>(*src++);
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    uint64_t zigzag(int64_t delta) { return static_cast<uint64_t>(delta << 1) ^ static_cast<uint64_t>(delta >> 63); }
+    int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+    // Cell bytes in the GPU buffers
+    size_t decodedSize(const ScenePack::BlockInfo &block, uint32_t numShCoeffs)
+    {
+        return block.numCells * (sizeof(glm::vec4) + sizeof(RadFoamCell) + sizeof(float) * numShCoeffs) +
+               block.numAdjacency * sizeof(uint32_t);
+    }
+
+    // Cells [0, numCells) of a block; adjacency is the block's own slice of the adjacency list
+    std::vector<char> encodeBlock(ScenePack::BlockInfo &block, const glm::vec4 *positions, const RadFoamCell *cells,
+                                  const float *sh, const uint32_t *adjacency, uint32_t numShCoeffs)
+    {
+        glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            boundsMin = glm::min(boundsMin, glm::vec3(positions[i]));
+            boundsMax = glm::max(boundsMax, glm::vec3(positions[i]));
+        }
+        std::memcpy(block.boundsMin, &boundsMin, sizeof(block.boundsMin));
+        std::memcpy(block.boundsMax, &boundsMax, sizeof(block.boundsMax));
+
+        std::vector<char> out(block.numCells * (sizeof(uint64_t) + sizeof(float) +
+                                                sizeof(uint16_t) * numShCoeffs));
+        char *dst = out.data();
+
+        glm::vec3 extent = boundsMax - boundsMin;
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            uint64_t packed = 0;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float t = extent[axis] > 0 ? (positions[i][axis] - boundsMin[axis]) / extent[axis] : 0.0f;
+                uint64_t q = static_cast<uint64_t>(std::llround(double(t) * positionMax));
+                packed |= std::min(q, positionMax) << (axis * ScenePack::positionBits);
+            }
+            std::memcpy(dst, &packed, sizeof(packed));
+            dst += sizeof(packed);
+        }
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            std::memcpy(dst, &cells[i].density, sizeof(float));
+            dst += sizeof(float);
+        }
+        for (size_t i = 0; i < size_t(block.numCells) * numShCoeffs; ++i)
+        {
+            uint16_t half = glm::packHalf1x16(sh[i]);
+            std::memcpy(dst, &half, sizeof(half));
+            dst += sizeof(half);
+        }
+
+        // Cell records hold the low words of the offsets, the block its 64-bit begin
+        uint64_t begin = block.adjacencyBegin;
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            uint64_t end = RadFoam::extendOffset(begin, cells[i].adjacencyEnd);
+            writeVarint(out, end - begin);
+            begin = end;
+        }
+        uint64_t cellEnd = RadFoam::extendOffset(block.adjacencyBegin, cells[0].adjacencyEnd);
+        for (uint32_t i = 0, cell = 0; i < block.numAdjacency; ++i)
+        {
+            while (block.adjacencyBegin + i >= cellEnd)
+                cellEnd = RadFoam::extendOffset(cellEnd, cells[++cell].adjacencyEnd);
+            writeVarint(out, zigzag(int64_t(adjacency[i]) - int64_t(block.firstCell + cell)));
+        }
+        return out;
+    }
+
+    bool decodeBlock(const ScenePack::BlockInfo &block, const char *src, uint32_t numShCoeffs,
+                     const ScenePack::Target &target)
+    {
+        const char *end = src + block.size;
+        size_t fixedSize = block.numCells * (sizeof(uint64_t) + sizeof(float) + sizeof(uint16_t) * numShCoeffs);
+        if (block.size < fixedSize)
+            return false;
+
+        glm::vec3 boundsMin, boundsMax;
+        std::memcpy(&boundsMin, block.boundsMin, sizeof(boundsMin));
+        std::memcpy(&boundsMax, block.boundsMax, sizeof(boundsMax));
+        glm::vec3 scale = (boundsMax - boundsMin) / float(positionMax);
+
+        const char *densities = src + block.numCells * sizeof(uint64_t);
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            uint64_t packed;
+            std::memcpy(&packed, src + i * sizeof(uint64_t), sizeof(packed));
+            glm::vec3 pos;
+            for (int axis = 0; axis < 3; ++axis)
+                pos[axis] = boundsMin[axis] +
+                            float((packed >> (axis * ScenePack::positionBits)) & positionMax) * scale[axis];
+
+            target.positions[i] = glm::vec4(pos, 0);
+            std::memcpy(&target.cells[i].density, densities + i * sizeof(float), sizeof(float));
+            if (target.hostPositions)
+                target.hostPositions[i] = pos;
+        }
+
+        const char *halves = densities + block.numCells * sizeof(float);
+        for (size_t i = 0; i < size_t(block.numCells) * numShCoeffs; ++i)
+        {
+            uint16_t half;
+            std::memcpy(&half, halves + i * sizeof(half), sizeof(half));
+            target.sh[i] = glm::unpackHalf1x16(half);
+        }
+
+        const char *stream = src + fixedSize;
+        uint64_t offset = block.adjacencyBegin;
+        for (uint32_t i = 0; i < block.numCells; ++i)
+        {
+            uint64_t count;
+            if (!readVarint(stream, end, count))
+                return false;
+            target.cells[i].adjacencyBegin = static_cast<uint32_t>(offset);
+            offset += count;
+            target.cells[i].adjacencyEnd = static_cast<uint32_t>(offset);
+        }
+        if (offset != block.adjacencyBegin + block.numAdjacency)
+            return false;
+
+        uint64_t cellEnd = RadFoam::extendOffset(block.adjacencyBegin, target.cells[0].adjacencyEnd);
+        for (uint32_t i = 0, cell = 0; i < block.numAdjacency; ++i)
+        {
+            while (block.adjacencyBegin + i >= cellEnd)
+                cellEnd = RadFoam::extendOffset(cellEnd, target.cells[++cell].adjacencyEnd);
+            uint64_t value;
+            if (!readVarint(stream, end, value))
+                return false;
+            target.adjacency[i] = static_cast<uint32_t>(int64_t(block.firstCell + cell) + unzigzag(value));
+        }
+        return stream == end;
+    }
+}
+
+void ScenePack::RoundTripError::merge(const RoundTripError &other)
+{
+    maxPosition = std::max(maxPosition, other.maxPosition);
+    sumSqPosition += other.sumSqPosition;
+    maxDensity = std::max(maxDensity, other.maxDensity);
+    maxSh = std::max(maxSh, other.maxSh);
+    sumSqSh += other.sumSqSh;
+    adjacencyMismatches += other.adjacencyMismatches;
+    numCells += other.numCells;
+    numShValues += other.numShValues;
+}
+
+bool ScenePack::isPackPath(const std::string &path)
+{
+    return std::filesystem::path(path).extension() == ".rfpack";
+}
+
+ScenePack::Writer::Writer(const std::string &path, uint32_t shDegree, uint64_t numVertices, uint64_t numAdjacency)
+    : path(path), tmpPath(path + ".tmp"), startTime(std::chrono::high_resolution_clock::now())
+{
+    ofs.open(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+        throw std::runtime_error("Failed to open pack file for writing: " + path);
+
+    std::memcpy(header.magic, packMagic, sizeof(packMagic));
+    header.version = formatVersion;
+    header.shDegree = shDegree;
+    header.numVertices = numVertices;
+    header.numAdjacency = numAdjacency;
+    header.numBlocks = (numVertices + cellsPerBlock - 1) / cellsPerBlock;
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    fileOffset = sizeof(Header);
+    blocks.reserve(header.numBlocks);
+}
+
+void ScenePack::Writer::append(const glm::vec4 *positions, const RadFoamCell *cells, const float *sh,
+                               const uint32_t *adjacency, size_t numCells)
+{
+    uint32_t numShCoeffs = 3 * (header.shDegree + 1) * (header.shDegree + 1);
+    uint64_t firstCell = blocks.empty() ? 0 : blocks.back().firstCell + blocks.back().numCells;
+    if (firstCell % cellsPerBlock != 0 || firstCell + numCells > header.numVertices)
+        throw std::invalid_argument("ScenePack::Writer: cells must arrive in whole blocks");
+
+    size_t firstBlock = blocks.size();
+    uint64_t adjacencyEnd = adjacencyBegin;
+    for (size_t local = 0; local < numCells; local += cellsPerBlock)
+    {
+        BlockInfo block{};
+        block.firstCell = firstCell + local;
+        block.numCells = static_cast<uint32_t>(std::min<size_t>(cellsPerBlock, numCells - local));
+        block.adjacencyBegin = adjacencyEnd;
+        adjacencyEnd = RadFoam::extendOffset(adjacencyEnd, cells[local + block.numCells - 1].adjacencyEnd);
+        block.numAdjacency = static_cast<uint32_t>(adjacencyEnd - block.adjacencyBegin);
+        blocks.push_back(block);
+    }
+
+    // Blocks are encoded and verified in parallel, then appended in order
+    std::vector<std::vector<char>> payloads(blocks.size() - firstBlock);
+    std::vector<RoundTripError> errors(payloads.size());
+    parallelFor(payloads.size(), [&](size_t begin, size_t end)
+                {
+        std::vector<glm::vec4> decodedPositions(cellsPerBlock);
+        std::vector<RadFoamCell> decodedCells(cellsPerBlock);
+        std::vector<float> decodedSh(size_t(cellsPerBlock) * numShCoeffs);
+        std::vector<uint32_t> decodedAdjacency;
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto &block = blocks[firstBlock + i];
+            size_t local = i * cellsPerBlock;
+            const uint32_t *blockAdjacency = adjacency + (block.adjacencyBegin - adjacencyBegin);
+            payloads[i] = encodeBlock(block, positions + local, cells + local, sh + local * numShCoeffs,
+                                      blockAdjacency, numShCoeffs);
+            block.size = payloads[i].size();
+            block.hash = SceneCache::hash(payloads[i].data(), payloads[i].size());
+
+            decodedAdjacency.resize(block.numAdjacency);
+            auto &e = errors[i];
+            if (!decodeBlock(block, payloads[i].data(), numShCoeffs,
+                             {decodedPositions.data(), decodedCells.data(), decodedSh.data(),
+                              decodedAdjacency.data(), nullptr}))
+            {
+                e.adjacencyMismatches += block.numAdjacency + block.numCells;
+                continue;
+            }
+            for (uint32_t c = 0; c < block.numCells; ++c)
+            {
+                double d = glm::distance(glm::vec3(positions[local + c]), glm::vec3(decodedPositions[c]));
+                e.maxPosition = std::max(e.maxPosition, d);
+                e.sumSqPosition += d * d;
+                e.maxDensity = std::max(e.maxDensity, double(std::abs(cells[local + c].density -
+                                                                      decodedCells[c].density)));
+                e.adjacencyMismatches += cells[local + c].adjacencyBegin != decodedCells[c].adjacencyBegin ||
+                                         cells[local + c].adjacencyEnd != decodedCells[c].adjacencyEnd;
+            }
+            for (size_t s = 0; s < size_t(block.numCells) * numShCoeffs; ++s)
+            {
+                double d = std::abs(double(sh[local * numShCoeffs + s]) - decodedSh[s]);
+                e.maxSh = std::max(e.maxSh, d);
+                e.sumSqSh += d * d;
+            }
+            for (uint32_t a = 0; a < block.numAdjacency; ++a)
+                e.adjacencyMismatches += blockAdjacency[a] != decodedAdjacency[a];
+            e.numCells += block.numCells;
+            e.numShValues += size_t(block.numCells) * numShCoeffs;
+        } }, 1);
+
+    for (size_t i = 0; i < payloads.size(); ++i)
+    {
+        blocks[firstBlock + i].offset = fileOffset;
+        ofs.write(payloads[i].data(), payloads[i].size());
+        fileOffset += payloads[i].size();
+        error.merge(errors[i]);
+    }
+    adjacencyBegin = adjacencyEnd;
+}
+
+void ScenePack::Writer::finish()
+{
+    if (blocks.size() != header.numBlocks || adjacencyBegin != header.numAdjacency)
+        throw std::logic_error("ScenePack::Writer: scene incomplete");
+
+    header.directoryOffset = fileOffset;
+    header.directoryHash = SceneCache::hash(blocks.data(), blocks.size() * sizeof(BlockInfo));
+    ofs.write(reinterpret_cast<const char *>(blocks.data()), blocks.size() * sizeof(BlockInfo));
+    fileOffset += blocks.size() * sizeof(BlockInfo);
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    ofs.close();
+    if (!ofs)
+    {
+        std::filesystem::remove(tmpPath);
+        throw std::runtime_error("Failed to write pack file: " + path);
+    }
+    std::filesystem::rename(tmpPath, path);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    uint32_t numShCoeffs = 3 * (header.shDegree + 1) * (header.shDegree + 1);
+    size_t rawSize = header.numVertices * (sizeof(glm::vec4) + sizeof(RadFoamCell) + sizeof(float) * numShCoeffs) +
+                     header.numAdjacency * sizeof(uint32_t);
+    std::cout << std::format("Scene pack written to {}: {}MB ({:.2f}x smaller than the GPU layout), {} blocks, {}ms\n",
+                             path, fileOffset >> 20, double(rawSize) / fileOffset, blocks.size(),
+                             std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count());
+    std::cout << std::format("  round trip: position max {:.3g} rms {:.3g}, density max {:.3g}, "
+                             "SH max {:.3g} rms {:.3g}, adjacency mismatches {}\n",
+                             error.maxPosition, std::sqrt(error.sumSqPosition / std::max<uint64_t>(error.numCells, 1)),
+                             error.maxDensity, error.maxSh,
+                             std::sqrt(error.sumSqSh / std::max<uint64_t>(error.numShValues, 1)),
+                             error.adjacencyMismatches);
+}
+
+void ScenePack::write(const std::string &path, RadFoam &model)
+{
+    Writer writer(path, model.getShDegree(), model.getNumVertices(), model.getNumAdjacency());
+    uint32_t numShCoeffs = model.getNumShCoeffs();
+
+    // Batches of whole blocks are read back from the GPU
+    constexpr size_t cellsPerBatch = 32 * cellsPerBlock;
+    std::vector<glm::vec4> positions;
+    std::vector<RadFoamCell> cells;
+    std::vector<float> sh;
+    std::vector<uint32_t> adjacency;
+    uint64_t adjacencyBegin = 0;
+    for (size_t firstCell = 0; firstCell < model.getNumVertices(); firstCell += cellsPerBatch)
+    {
+        size_t numCells = std::min<size_t>(cellsPerBatch, model.getNumVertices() - firstCell);
+        positions.resize(numCells);
+        cells.resize(numCells);
+        sh.resize(numCells * numShCoeffs);
+        model.getPositionBuffer()->downloadData(positions.data(), numCells * sizeof(glm::vec4),
+                                                firstCell * sizeof(glm::vec4));
+        model.getCellBuffer()->downloadData(cells.data(), numCells * sizeof(RadFoamCell),
+                                            firstCell * sizeof(RadFoamCell));
+        model.getShBuffer()->downloadData(sh.data(), sh.size() * sizeof(float),
+                                          firstCell * numShCoeffs * sizeof(float));
+        uint64_t adjacencyEnd = RadFoam::extendOffset(adjacencyBegin, cells.back().adjacencyEnd);
+        adjacency.resize(adjacencyEnd - adjacencyBegin);
+        if (!adjacency.empty())
+            model.getAdjacencyBuffer()->downloadData(adjacency.data(), adjacency.size() * sizeof(uint32_t),
+                                                     adjacencyBegin * sizeof(uint32_t));
+
+        writer.append(positions.data(), cells.data(), sh.data(), adjacency.data(), numCells);
+        adjacencyBegin = adjacencyEnd;
+    }
+    writer.finish();
+}
+
+ScenePack::ScenePack(const std::string &path) : path(path), file(path)
+{
+    if (file.size() < sizeof(Header))
+        throw std::runtime_error("Scene pack truncated: " + path);
+    std::memcpy(&header, file.data(), sizeof(Header));
+    if (std::memcmp(header.magic, packMagic, sizeof(packMagic)) != 0)
+        throw std::runtime_error("Not a scene pack: " + path);
+    if (header.version != formatVersion)
+        throw std::runtime_error("Scene pack format version mismatch: " + path);
+    if (header.shDegree > 3)
+        throw std::runtime_error("Scene pack has unsupported SH degree: " + path);
+    if (header.numBlocks != (header.numVertices + cellsPerBlock - 1) / cellsPerBlock ||
+        header.directoryOffset + header.numBlocks * sizeof(BlockInfo) > file.size())
+        throw std::runtime_error("Scene pack truncated: " + path);
+
+    blocks.resize(header.numBlocks);
+    std::memcpy(blocks.data(), file.data() + header.directoryOffset, blocks.size() * sizeof(BlockInfo));
+    if (SceneCache::hash(blocks.data(), blocks.size() * sizeof(BlockInfo)) != header.directoryHash)
+        throw std::runtime_error("Scene pack directory is corrupt: " + path);
+
+    // Blocks must tile the cell and adjacency ranges so that they can be decoded independently.
+    // Every block but the last is full, as PagedScene sizes its pages by cellsPerBlock.
+    uint64_t cell = 0, adjacency = 0;
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        auto &block = blocks[b];
+        bool full = block.numCells == cellsPerBlock;
+        bool last = b + 1 == blocks.size();
+        if (block.firstCell != cell || block.adjacencyBegin != adjacency || !(full || (last && block.numCells > 0)) ||
+            block.offset + block.size > header.directoryOffset)
+            throw std::runtime_error("Scene pack directory is corrupt: " + path);
+        cell += block.numCells;
+        adjacency += block.numAdjacency;
+    }
+    if (cell != header.numVertices || adjacency != header.numAdjacency)
+        throw std::runtime_error("Scene pack directory is corrupt: " + path);
+}
+
+size_t ScenePack::getDecodedSize(size_t first, size_t last) const
+{
+    size_t size = 0;
+    for (size_t b = first; b < last; ++b)
+        size += decodedSize(blocks[b], getNumShCoeffs());
+    return size;
+}
+
+void ScenePack::decode(size_t first, size_t last, const Target &target) const
+{
+    std::atomic<bool> corrupt = false;
+    parallelFor(last - first, [&](size_t begin, size_t end)
+                {
+        for (size_t b = first + begin; b < first + end; ++b)
+        {
+            auto &block = blocks[b];
+            size_t cell = block.firstCell - blocks[first].firstCell;
+            size_t adjacency = block.adjacencyBegin - blocks[first].adjacencyBegin;
+            const char *payload = file.data() + block.offset;
+            if (SceneCache::hash(payload, block.size) != block.hash ||
+                !decodeBlock(block, payload, getNumShCoeffs(),
+                             {target.positions + cell, target.cells + cell, target.sh + cell * getNumShCoeffs(),
+                              target.adjacency + adjacency,
+                              target.hostPositions ? target.hostPositions + cell : nullptr}))
+                corrupt = true;
+        } }, 1);
+
+    if (corrupt)
+        throw std::runtime_error("Scene pack block is corrupt: " + path);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "radfoam.hpp"
+#include "platform.hpp"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Compressed scene container (.rfpack) made of independently decodable blocks of cells.
+// Per block: positions quantized to 21 bits per axis inside the block bounds, float32
+// density, float16 SH, and varint neighbour counts plus zigzag varint neighbour ids
+// relative to the owning cell (small when cells are spatially sorted).
+class ScenePack
+{
+public:
+    static constexpr uint32_t formatVersion = 2;
+    static constexpr uint32_t cellsPerBlock = 8192;
+    static constexpr uint32_t positionBits = 21;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t shDegree;
+        uint64_t numVertices;
+        uint64_t numAdjacency;
+        uint64_t numBlocks;
+        uint64_t directoryOffset; // BlockInfo[numBlocks]
+        uint64_t directoryHash;   // SceneCache::hash of the directory
+    };
+
+    struct BlockInfo
+    {
+        uint64_t offset; // Payload position in the file
+        uint64_t size;
+        uint64_t firstCell;
+        uint64_t adjacencyBegin;
+        uint32_t numCells;
+        uint32_t numAdjacency;
+        float boundsMin[3];
+        float boundsMax[3];
+        uint64_t hash; // SceneCache::hash of the payload
+    };
+
+    // Destination arrays of a decode, indexed from the first cell / adjacency entry of the range
+    struct Target
+    {
+        glm::vec4 *positions;
+        RadFoam::RadFoamCell *cells;
+        float *sh;
+        uint32_t *adjacency;
+        glm::vec3 *hostPositions; // Optional
+    };
+
+    // Encoding error measured by decoding every block right after encoding it
+    struct RoundTripError
+    {
+        double maxPosition = 0;
+        double sumSqPosition = 0;
+        double maxDensity = 0;
+        double maxSh = 0;
+        double sumSqSh = 0;
+        uint64_t adjacencyMismatches = 0;
+        uint64_t numCells = 0;
+        uint64_t numShValues = 0;
+
+        void merge(const RoundTripError &other);
+    };
+
+    // Streaming encoder: cells are appended in order, in whole blocks except for the last call
+    class Writer
+    {
+    public:
+        Writer(const std::string &path, uint32_t shDegree, uint64_t numVertices, uint64_t numAdjacency);
+
+        // adjacency starts at the first neighbour of the first appended cell
+        void append(const glm::vec4 *positions, const RadFoam::RadFoamCell *cells, const float *sh,
+                    const uint32_t *adjacency, size_t numCells);
+        // Writes the directory, renames the file into place and prints the round-trip report
+        void finish();
+
+    private:
+        std::string path;
+        std::string tmpPath;
+        std::ofstream ofs;
+        Header header{};
+        std::vector<BlockInfo> blocks;
+        RoundTripError error;
+        uint64_t fileOffset = 0;
+        uint64_t adjacencyBegin = 0;
+        std::chrono::high_resolution_clock::time_point startTime;
+    };
+
+    static bool isPackPath(const std::string &path);
+    // Encodes the scene currently held in the model's GPU buffers
+    static void write(const std::string &path, RadFoam &model);
+
+    explicit ScenePack(const std::string &path);
+
+    const Header &getHeader() const { return header; }
+    const std::vector<BlockInfo> &getBlocks() const { return blocks; }
+    uint32_t getNumShCoeffs() const { return 3 * (header.shDegree + 1) * (header.shDegree + 1); }
+    // Bytes the blocks [first, last) occupy once decoded into the GPU buffers
+    size_t getDecodedSize(size_t first, size_t last) const;
+
+    // Decodes the blocks [first, last) on all cores; throws if any block is corrupt
+    void decode(size_t first, size_t last, const Target &target) const;
+
+private:
+    std::string path;
+    MappedFile file;
+    Header header;
+    std::vector<BlockInfo> blocks;
+};
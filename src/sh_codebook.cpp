@@ -0,0 +1,243 @@
+#include "sh_codebook.hpp"
+#include "parallel.hpp"
+#include <glm/gtc/packing.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+namespace
+{
+    constexpr char codebookMagic[8] = {'R', 'F', 'V', 'Q', '\0', '\0', '\0', '\0'};
+
+    constexpr size_t cellsPerBatch = 1 << 18;
+    // Training set: every n-th cell, enough for the smaller of the scene and this many per entry
+    constexpr size_t minTrainingSamples = 1 << 16;
+    constexpr size_t samplesPerEntry = 32;
+    constexpr uint32_t numIterations = 10;
+}
+
+std::string ShCodebook::getPath(const RadFoamVulkanArgs &args)
+{
+    return std::filesystem::path(args.scenePath).replace_extension(".rfvq").string();
+}
+
+ShCodebook::ShCodebook(const RadFoamVulkanArgs &args, RadFoam &model, uint32_t numEntries)
+{
+    if (model.getShDegree() == 0)
+        throw std::runtime_error("SH codebook needs a scene with SH degree 1 or higher");
+    if (numEntries > maxEntries)
+        throw std::runtime_error(std::format("SH codebook of {} entries requested, at most {} are supported",
+                                             numEntries, maxEntries));
+    size_t numCells = model.getNumStoredCells();
+    std::memcpy(header.magic, codebookMagic, sizeof(codebookMagic));
+    header.version = formatVersion;
+    header.numEntries = static_cast<uint32_t>(std::clamp<size_t>(numEntries, 1, numCells));
+    header.source = SceneCache::getSourceStamp(args.scenePath);
+    header.numCells = numCells;
+    header.shDegree = model.getShDegree();
+
+    auto path = getPath(args);
+    if (!args.noCache && load(path))
+        return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    build(model);
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << std::format("SH codebook built in {}ms: {} entries, rms error {:.4f}\n",
+                             std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count(),
+                             header.numEntries, header.rmsError);
+    if (!args.noCache)
+        save(path);
+}
+
+void ShCodebook::build(RadFoam &model)
+{
+    uint32_t numShCoeffs = model.getNumShCoeffs();
+    uint32_t dims = numShCoeffs - 3;
+    size_t numCells = header.numCells;
+    size_t step = std::max<size_t>(1, numCells / std::max(minTrainingSamples, header.numEntries * samplesPerEntry));
+    size_t numSamples = (numCells + step - 1) / step;
+
+    // SH are read back from the device in batches, once for training and once for the assignment
+    std::vector<float> batch;
+    auto forEachBatch = [&](auto &&fn)
+    {
+        for (size_t first = 0; first < numCells; first += cellsPerBatch)
+        {
+            size_t count = std::min(cellsPerBatch, numCells - first);
+            batch.resize(count * numShCoeffs);
+            model.getShBuffer()->downloadData(batch.data(), batch.size() * sizeof(float),
+                                              first * numShCoeffs * sizeof(float));
+            fn(first, count);
+        }
+    };
+
+    std::vector<float> samples(numSamples * dims);
+    forEachBatch([&](size_t first, size_t count)
+                 {
+        for (size_t i = (first + step - 1) / step * step; i < first + count; i += step)
+            std::memcpy(samples.data() + (i / step) * dims, batch.data() + (i - first) * numShCoeffs + 3,
+                        dims * sizeof(float)); });
+    train(samples, numSamples, dims);
+    samples = {};
+
+    cellWords.resize(numCells);
+    forEachBatch([&](size_t first, size_t count)
+                 { parallelFor(count, [&](size_t begin, size_t end)
+                               {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const float *sh = batch.data() + i * numShCoeffs;
+            uint32_t entry = nearest(sh + 3, dims);
+            cellWords[first + i] = glm::uvec2(glm::packHalf2x16(glm::vec2(sh[0], sh[1])),
+                                              glm::packHalf2x16(glm::vec2(sh[2], 0.0f)) | (entry << 16));
+        } }, 256); });
+}
+
+void ShCodebook::train(const std::vector<float> &samples, size_t numSamples, uint32_t dims)
+{
+    uint32_t numEntries = header.numEntries;
+    codebook.resize(size_t(numEntries) * dims);
+    for (uint32_t k = 0; k < numEntries; ++k)
+        std::memcpy(codebook.data() + size_t(k) * dims, samples.data() + (size_t(k) * numSamples / numEntries) * dims,
+                    dims * sizeof(float));
+
+    std::vector<uint32_t> assign(numSamples);
+    std::vector<uint32_t> memberBegin(numEntries + 1);
+    std::vector<uint32_t> members(numSamples);
+    for (uint32_t iteration = 0; iteration < numIterations; ++iteration)
+    {
+        std::mutex mutex;
+        double error = 0.0;
+        parallelFor(numSamples, [&](size_t begin, size_t end)
+                    {
+            double localError = 0.0;
+            for (size_t i = begin; i < end; ++i)
+            {
+                float distance;
+                assign[i] = nearest(samples.data() + i * dims, dims, &distance);
+                localError += distance;
+            }
+            std::lock_guard lock(mutex);
+            error += localError; }, 256);
+        header.rmsError = static_cast<float>(std::sqrt(error / (double(numSamples) * dims)));
+
+        // Members of every entry, then each entry moves to their mean; empty entries stay put
+        std::fill(memberBegin.begin(), memberBegin.end(), 0);
+        for (size_t i = 0; i < numSamples; ++i)
+            memberBegin[assign[i] + 1]++;
+        for (uint32_t k = 0; k < numEntries; ++k)
+            memberBegin[k + 1] += memberBegin[k];
+        {
+            std::vector<uint32_t> cursor(memberBegin.begin(), memberBegin.end() - 1);
+            for (size_t i = 0; i < numSamples; ++i)
+                members[cursor[assign[i]]++] = static_cast<uint32_t>(i);
+        }
+        parallelFor(numEntries, [&](size_t begin, size_t end)
+                    {
+            std::vector<double> sum(dims);
+            for (size_t k = begin; k < end; ++k)
+            {
+                if (memberBegin[k] == memberBegin[k + 1])
+                    continue;
+                std::fill(sum.begin(), sum.end(), 0.0);
+                for (uint32_t m = memberBegin[k]; m < memberBegin[k + 1]; ++m)
+                {
+                    const float *v = samples.data() + size_t(members[m]) * dims;
+                    for (uint32_t j = 0; j < dims; ++j)
+                        sum[j] += v[j];
+                }
+                double scale = 1.0 / (memberBegin[k + 1] - memberBegin[k]);
+                for (uint32_t j = 0; j < dims; ++j)
+                    codebook[k * dims + j] = static_cast<float>(sum[j] * scale);
+            } }, 64);
+    }
+}
+
+uint32_t ShCodebook::nearest(const float *v, uint32_t dims, float *distance) const
+{
+    // Partial distances: an entry is dropped as soon as one color triple exceeds the best so far
+    uint32_t best = 0;
+    float bestDistance = INFINITY;
+    for (uint32_t k = 0; k < header.numEntries; ++k)
+    {
+        const float *c = codebook.data() + size_t(k) * dims;
+        float d = 0.0f;
+        for (uint32_t j = 0; j < dims && d < bestDistance; j += 3)
+        {
+            float dr = v[j] - c[j], dg = v[j + 1] - c[j + 1], db = v[j + 2] - c[j + 2];
+            d += dr * dr + dg * dg + db * db;
+        }
+        if (d < bestDistance)
+            bestDistance = d, best = k;
+    }
+    if (distance)
+        *distance = bestDistance;
+    return best;
+}
+
+void ShCodebook::attach(RadFoam &model, bool keepFloat)
+{
+    auto usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    auto cellBuffer = std::make_shared<Buffer>(cellWords.size() * sizeof(glm::uvec2), usage,
+                                               VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    cellBuffer->uploadData(cellWords.data(), cellWords.size() * sizeof(glm::uvec2));
+    codebookBuffer = std::make_shared<Buffer>(codebook.size() * sizeof(float), usage,
+                                              VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    codebookBuffer->uploadData(codebook.data(), codebook.size() * sizeof(float));
+
+    std::cout << std::format("SH codebook: {} entries, SH memory {}MB -> {}MB (codebook {}KB)\n",
+                             header.numEntries, model.shBuffer->getSize() >> 20,
+                             (cellBuffer->getSize() + codebookBuffer->getSize()) >> 20,
+                             codebookBuffer->getSize() >> 10);
+    if (keepFloat)
+        model.floatShBuffer = model.shBuffer;
+    model.shBuffer = cellBuffer;
+
+    cellWords = {};
+    codebook = {};
+}
+
+bool ShCodebook::load(const std::string &path)
+{
+    if (!std::filesystem::exists(path))
+        return false;
+
+    SceneCache::FileCheck check("SH codebook", path);
+    MappedFile file(path);
+    if (file.size() < sizeof(Header))
+        return check.reject("truncated");
+    Header stored;
+    std::memcpy(&stored, file.data(), sizeof(Header));
+    if (!check.checkHeader(stored, codebookMagic, formatVersion, header.source))
+        return false;
+    if (stored.numCells != header.numCells || stored.shDegree != header.shDegree ||
+        stored.numEntries != header.numEntries)
+        return check.reject("does not match the scene or codebook size");
+
+    size_t dims = 3 * (header.shDegree + 1) * (header.shDegree + 1) - 3;
+    size_t payloadSize = header.numEntries * dims * sizeof(float) + header.numCells * sizeof(glm::uvec2);
+    if (!check.checkPayload(file, sizeof(Header), payloadSize, stored.contentHash))
+        return false;
+
+    header = stored;
+    const char *src = file.data() + sizeof(Header);
+    codebook.resize(header.numEntries * dims);
+    std::memcpy(codebook.data(), src, codebook.size() * sizeof(float));
+    src += codebook.size() * sizeof(float);
+    cellWords.resize(header.numCells);
+    std::memcpy(cellWords.data(), src, cellWords.size() * sizeof(glm::uvec2));
+    return true;
+}
+
+void ShCodebook::save(const std::string &path) const
+{
+    Header written = header;
+    SceneCache::writeFile(path, "SH codebook", written, sizeof(Header), [this](std::ostream &ofs)
+                          {
+        ofs.write(reinterpret_cast<const char *>(codebook.data()), codebook.size() * sizeof(float));
+        ofs.write(reinterpret_cast<const char *>(cellWords.data()), cellWords.size() * sizeof(glm::uvec2)); });
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "radfoam.hpp"
+#include "scene_cache.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Vector-quantized SH, stored next to the scene (.rfvq). The higher bands of every cell are
+// clustered with k-means and replaced by the index of their centroid; the DC term stays per
+// cell as float16. On the GPU every cell is two words, DC red/green and DC blue with the
+// 16-bit entry index, and ray_tracing.comp reads the higher bands through the codebook.
+class ShCodebook
+{
+public:
+    static constexpr uint32_t formatVersion = 1;
+    // The entry index has 16 bits, but nearest() compares against every entry, once per training
+    // sample and iteration and once per cell, so the count is held well below that
+    static constexpr uint32_t maxEntries = 4096;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numEntries;
+        SceneCache::SourceStamp source;
+        uint64_t numCells; // Including coarse LOD cells
+        uint32_t shDegree;
+        uint32_t reserved;
+        float rmsError;       // Of the higher bands over the training set
+        uint32_t reserved2;
+        uint64_t contentHash; // Hash of everything after the header
+    };
+
+    static std::string getPath(const RadFoamVulkanArgs &args);
+
+    // Loads the codebook from <scene>.rfvq, or clusters the model's SH and writes it
+    ShCodebook(const RadFoamVulkanArgs &args, RadFoam &model, uint32_t numEntries);
+
+    // Replaces the model's SH buffer by the per-cell words and uploads the codebook.
+    // keepFloat leaves the float32 SH with the model for quality reports.
+    void attach(RadFoam &model, bool keepFloat);
+
+    uint32_t getNumEntries() const { return header.numEntries; }
+    auto getCodebookBuffer() { return codebookBuffer; }
+
+private:
+    void build(RadFoam &model);
+    // Centroids from a subsample of the cells, Lloyd iterations in parallel
+    void train(const std::vector<float> &samples, size_t numSamples, uint32_t dims);
+    uint32_t nearest(const float *v, uint32_t dims, float *distance = nullptr) const;
+    // Accepts the file when its header matches the expected one in header
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+
+    Header header{};
+    std::vector<float> codebook;       // numEntries * (numShCoeffs - 3)
+    std::vector<glm::uvec2> cellWords; // Per cell: packHalf2x16(dc.rg), half(dc.b) | index << 16
+
+    std::shared_ptr<Buffer> codebookBuffer;
+};
@@ -0,0 +1,227 @@
+#include "spatial_order.hpp"
+#include "parallel.hpp"
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+    constexpr uint32_t bitsPerAxis = 21;
+    constexpr uint32_t radixBits = 8;
+    constexpr uint32_t numBuckets = 1 << radixBits;
+
+    // Spreads the low 21 bits of v to every third bit
+    uint64_t expandBits(uint32_t v)
+    {
+        uint64_t x = v & 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
+
+    uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z)
+    {
+        return expandBits(x) << 2 | expandBits(y) << 1 | expandBits(z);
+    }
+
+    // Skilling's transform ("Programming the Hilbert curve", 2004): the coordinates become the
+    // transposed Hilbert index, which interleaves into the key like a Morton code
+    uint64_t hilbertKey(uint32_t x, uint32_t y, uint32_t z)
+    {
+        uint32_t v[3] = {x, y, z};
+        for (uint32_t q = 1u << (bitsPerAxis - 1); q > 1; q >>= 1)
+        {
+            uint32_t p = q - 1;
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                if (v[i] & q)
+                    v[0] ^= p;
+                else
+                {
+                    uint32_t t = (v[0] ^ v[i]) & p;
+                    v[0] ^= t;
+                    v[i] ^= t;
+                }
+            }
+        }
+
+        // Gray encode
+        v[1] ^= v[0];
+        v[2] ^= v[1];
+        uint32_t t = 0;
+        for (uint32_t q = 1u << (bitsPerAxis - 1); q > 1; q >>= 1)
+            if (v[2] & q)
+                t ^= q - 1;
+        for (uint32_t i = 0; i < 3; ++i)
+            v[i] ^= t;
+
+        return mortonKey(v[0], v[1], v[2]);
+    }
+}
+
+SpatialOrder::Curve SpatialOrder::parseCurve(const std::string &name)
+{
+    if (name == "morton")
+        return Curve::Morton;
+    if (name == "hilbert")
+        return Curve::Hilbert;
+    throw std::runtime_error("Unknown space-filling curve: " + name + " (expected morton or hilbert)");
+}
+
+std::vector<uint64_t> SpatialOrder::computeKeys(const glm::vec4 *positions, size_t count, Curve curve)
+{
+    glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+    std::mutex mutex;
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        glm::vec3 localMin(INFINITY), localMax(-INFINITY);
+        for (size_t i = begin; i < end; ++i)
+        {
+            localMin = glm::min(localMin, glm::vec3(positions[i]));
+            localMax = glm::max(localMax, glm::vec3(positions[i]));
+        }
+        std::lock_guard lock(mutex);
+        boundsMin = glm::min(boundsMin, localMin);
+        boundsMax = glm::max(boundsMax, localMax); });
+
+    // One scale for all axes keeps the curve's cells cubes
+    float extent = std::max(glm::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z);
+    float scale = extent > 0.0f ? float((1u << bitsPerAxis) - 1) / extent : 0.0f;
+
+    std::vector<uint64_t> keys(count);
+    parallelFor(count, [&](size_t begin, size_t end)
+                {
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::uvec3 q = glm::uvec3((glm::vec3(positions[i]) - boundsMin) * scale + 0.5f);
+            q = glm::min(q, glm::uvec3((1u << bitsPerAxis) - 1));
+            keys[i] = curve == Curve::Hilbert ? hilbertKey(q.x, q.y, q.z) : mortonKey(q.x, q.y, q.z);
+        } });
+    return keys;
+}
+
+std::vector<uint32_t> SpatialOrder::sortKeys(std::vector<uint64_t> &keys)
+{
+    size_t count = keys.size();
+    std::vector<uint32_t> order(count), orderScratch(count);
+    std::vector<uint64_t> keyScratch(count);
+    std::iota(order.begin(), order.end(), 0u);
+    if (count == 0)
+        return order;
+
+    // Every chunk counts its digits, then scatters them to offsets ordered by digit and chunk
+    size_t numChunks = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), (count + 4095) / 4096);
+    size_t chunkSize = (count + numChunks - 1) / numChunks;
+    std::vector<std::array<size_t, numBuckets>> offsets(numChunks);
+    for (uint32_t shift = 0; shift < 3 * bitsPerAxis; shift += radixBits)
+    {
+        parallelFor(numChunks, [&](size_t begin, size_t end)
+                    {
+            for (size_t c = begin; c < end; ++c)
+            {
+                offsets[c].fill(0);
+                for (size_t i = c * chunkSize; i < std::min(count, (c + 1) * chunkSize); ++i)
+                    offsets[c][(keys[i] >> shift) & (numBuckets - 1)]++;
+            } }, 1);
+
+        bool sorted = false;
+        size_t total = 0;
+        for (uint32_t d = 0; d < numBuckets; ++d)
+            for (size_t c = 0; c < numChunks; ++c)
+            {
+                size_t n = offsets[c][d];
+                sorted |= n == count;
+                offsets[c][d] = total;
+                total += n;
+            }
+        // All keys share this digit
+        if (sorted)
+            continue;
+
+        parallelFor(numChunks, [&](size_t begin, size_t end)
+                    {
+            for (size_t c = begin; c < end; ++c)
+                for (size_t i = c * chunkSize; i < std::min(count, (c + 1) * chunkSize); ++i)
+                {
+                    size_t dst = offsets[c][(keys[i] >> shift) & (numBuckets - 1)]++;
+                    keyScratch[dst] = keys[i];
+                    orderScratch[dst] = order[i];
+                } }, 1);
+        keys.swap(keyScratch);
+        order.swap(orderScratch);
+    }
+    return order;
+}
+
+void SpatialOrder::apply(const std::vector<uint32_t> &order, uint32_t numShCoeffs, std::vector<glm::vec4> &positions,
+                         std::vector<RadFoam::RadFoamCell> &cells, std::vector<float> &sh,
+                         std::vector<uint32_t> &adjacency)
+{
+    size_t numCells = order.size();
+    if (positions.size() != numCells || cells.size() != numCells || sh.size() != numCells * numShCoeffs)
+        throw std::runtime_error("Spatial order does not match the scene");
+
+    std::vector<uint32_t> newIndex(numCells);
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t n = begin; n < end; ++n)
+            newIndex[order[n]] = static_cast<uint32_t>(n); });
+
+    std::vector<glm::vec4> newPositions(numCells);
+    std::vector<RadFoam::RadFoamCell> newCells(numCells);
+    std::vector<float> newSh(sh.size());
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t n = begin; n < end; ++n)
+        {
+            uint32_t old = order[n];
+            newPositions[n] = positions[old];
+            newCells[n] = cells[old];
+            std::memcpy(newSh.data() + n * numShCoeffs, sh.data() + size_t(old) * numShCoeffs,
+                        numShCoeffs * sizeof(float));
+        } });
+    positions = std::move(newPositions);
+    sh = std::move(newSh);
+
+    // Neighbour ranges follow the new cell order; the ids inside them are renumbered
+    std::vector<uint32_t> newBegin(numCells + 1);
+    for (size_t n = 0; n < numCells; ++n)
+    {
+        const auto &cell = newCells[n];
+        if (cell.adjacencyEnd < cell.adjacencyBegin || cell.adjacencyEnd > adjacency.size())
+            throw std::runtime_error("Adjacency offsets out of range");
+        newBegin[n + 1] = newBegin[n] + (cell.adjacencyEnd - cell.adjacencyBegin);
+    }
+    if (newBegin[numCells] != adjacency.size())
+        throw std::runtime_error("Adjacency ranges do not cover the adjacency list");
+
+    std::vector<uint32_t> newAdjacency(adjacency.size());
+    parallelFor(numCells, [&](size_t begin, size_t end)
+                {
+        for (size_t n = begin; n < end; ++n)
+        {
+            auto &cell = newCells[n];
+            uint32_t *dst = newAdjacency.data() + newBegin[n];
+            for (uint32_t a = cell.adjacencyBegin; a < cell.adjacencyEnd; ++a)
+                *dst++ = adjacency[a] < numCells ? newIndex[adjacency[a]] : adjacency[a];
+            cell.adjacencyBegin = newBegin[n];
+            cell.adjacencyEnd = newBegin[n + 1];
+        } });
+    cells = std::move(newCells);
+    adjacency = std::move(newAdjacency);
+}
+
+void SpatialOrder::writePermutation(const std::string &path, const std::vector<uint32_t> &order)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(order.data()), order.size() * sizeof(uint32_t));
+    if (!ofs)
+        throw std::runtime_error("Failed to write permutation: " + path);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "radfoam.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Space-filling curve order of the cells. Cells close in space end up close in memory, which
+// keeps the neighbours of a traversal step in cache and makes the pairs that build_leaves.comp
+// merges into leaves spatially tight.
+class SpatialOrder
+{
+public:
+    enum class Curve
+    {
+        Morton,
+        Hilbert
+    };
+
+    // "morton" or "hilbert"
+    static Curve parseCurve(const std::string &name);
+
+    // 63-bit curve keys of the positions quantized to 21 bits per axis within their bounds
+    static std::vector<uint64_t> computeKeys(const glm::vec4 *positions, size_t count, Curve curve);
+    // Stable parallel LSD radix sort; returns order[newIndex] = oldIndex and leaves keys sorted
+    static std::vector<uint32_t> sortKeys(std::vector<uint64_t> &keys);
+
+    // Moves every cell to its new index and renumbers the neighbour ids and ranges to match
+    static void apply(const std::vector<uint32_t> &order, uint32_t numShCoeffs, std::vector<glm::vec4> &positions,
+                      std::vector<RadFoam::RadFoamCell> &cells, std::vector<float> &sh,
+                      std::vector<uint32_t> &adjacency);
+
+    // Original id of every cell in the new order, as raw little-endian uint32
+    static void writePermutation(const std::string &path, const std::vector<uint32_t> &order);
+};
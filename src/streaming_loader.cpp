@@ -0,0 +1,224 @@
+#include "streaming_loader.hpp"
+#include <chrono>
+
+namespace
+{
+    double elapsedMs(std::chrono::high_resolution_clock::time_point since)
+    {
+        auto now = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(now - since).count();
+    }
+}
+
+ChunkReader::ChunkReader(const std::string &path, size_t begin, size_t size,
+                         size_t chunkSize, uint32_t numChunks)
+    : file(path, std::ios::binary), begin(begin), size(size), chunkSize(chunkSize)
+{
+    if (!file)
+        throw std::runtime_error("Failed to open file: " + path);
+    if (chunkSize == 0)
+        throw std::invalid_argument("ChunkReader: chunk size must not be zero");
+
+    buffers.resize(numChunks);
+    for (auto &buffer : buffers)
+    {
+        buffer.resize(std::min(chunkSize, size));
+        freeBuffers.push(buffer.data());
+    }
+    thread = std::thread(&ChunkReader::run, this);
+}
+
+ChunkReader::~ChunkReader()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    freeCondition.notify_all();
+    thread.join();
+}
+
+void ChunkReader::run()
+{
+    try
+    {
+        file.seekg(begin);
+        for (size_t offset = 0; offset < size; offset += chunkSize)
+        {
+            char *buffer;
+            {
+                std::unique_lock lock(mutex);
+                freeCondition.wait(lock, [this]
+                                   { return stopping || !freeBuffers.empty(); });
+                if (stopping)
+                    return;
+                buffer = freeBuffers.front();
+                freeBuffers.pop();
+            }
+
+            size_t bytes = std::min(chunkSize, size - offset);
+            file.read(buffer, bytes);
+            if (static_cast<size_t>(file.gcount()) != bytes)
+                throw std::runtime_error("ChunkReader: unexpected end of file");
+
+            {
+                std::lock_guard lock(mutex);
+                readyChunks.push({buffer, offset, bytes});
+            }
+            readyCondition.notify_one();
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard lock(mutex);
+        error = std::current_exception();
+    }
+    readyCondition.notify_one();
+}
+
+bool ChunkReader::next(Chunk &chunk)
+{
+    if (consumed >= size)
+        return false;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::unique_lock lock(mutex);
+    readyCondition.wait(lock, [this]
+                        { return error || !readyChunks.empty(); });
+    waitMs += elapsedMs(startTime);
+
+    if (readyChunks.empty())
+        std::rethrow_exception(error);
+
+    chunk = readyChunks.front();
+    readyChunks.pop();
+    consumed += chunk.size;
+    return true;
+}
+
+void ChunkReader::release(const Chunk &chunk)
+{
+    {
+        std::lock_guard lock(mutex);
+        freeBuffers.push(const_cast<char *>(chunk.data));
+    }
+    freeCondition.notify_one();
+}
+
+StreamingUploader::StreamingUploader(VkDeviceSize slotSize, uint32_t numSlots)
+    : slotSize(slotSize), slots(numSlots)
+{
+    auto &context = VulkanContext::getContext();
+    auto device = context.getDevice();
+
+    // Own pool so that streaming does not share command buffers with single time commands
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = context.getQueueFamilyIndex();
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    ERR_GUARD_VULKAN(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+
+    for (auto &slot : slots)
+    {
+        slot.staging = std::make_unique<Buffer>(slotSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                VMA_MEMORY_USAGE_AUTO_PREFER_HOST, 0, true);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        ERR_GUARD_VULKAN(vkAllocateCommandBuffers(device, &allocInfo, &slot.cmd));
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        ERR_GUARD_VULKAN(vkCreateFence(device, &fenceInfo, nullptr, &slot.fence));
+    }
+}
+
+StreamingUploader::~StreamingUploader()
+{
+    auto device = VulkanContext::getContext().getDevice();
+    for (auto &slot : slots)
+    {
+        wait(slot);
+        vkDestroyFence(device, slot.fence, nullptr);
+    }
+    vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+std::vector<void *> StreamingUploader::stage(const std::vector<Region> &regions)
+{
+    constexpr VkDeviceSize alignment = 16;
+    auto alignUp = [](VkDeviceSize value)
+    { return (value + alignment - 1) / alignment * alignment; };
+
+    VkDeviceSize total = 0;
+    for (auto &region : regions)
+        total += alignUp(region.size);
+    if (total > slotSize)
+        throw std::invalid_argument("StreamingUploader: regions exceed the slot size");
+
+    if (slots[currentSlot].used + total > slotSize)
+    {
+        submit(slots[currentSlot]);
+        currentSlot = (currentSlot + 1) % slots.size();
+        wait(slots[currentSlot]);
+    }
+
+    auto &slot = slots[currentSlot];
+    std::vector<void *> pointers;
+    for (auto &region : regions)
+    {
+        pointers.push_back(static_cast<char *>(slot.staging->mappedData) + slot.used);
+        if (region.size > 0)
+            slot.copies.push_back({region.dst->getBuffer(), {slot.used, region.dstOffset, region.size}});
+        slot.used += alignUp(region.size);
+        bytesUploaded += region.size;
+    }
+    return pointers;
+}
+
+void StreamingUploader::flush()
+{
+    submit(slots[currentSlot]);
+    for (auto &slot : slots)
+        wait(slot);
+}
+
+void StreamingUploader::submit(Slot &slot)
+{
+    if (slot.copies.empty())
+        return;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    ERR_GUARD_VULKAN(vkResetCommandBuffer(slot.cmd, 0));
+    ERR_GUARD_VULKAN(vkBeginCommandBuffer(slot.cmd, &beginInfo));
+    for (auto &[dst, region] : slot.copies)
+        vkCmdCopyBuffer(slot.cmd, slot.staging->getBuffer(), dst, 1, &region);
+    ERR_GUARD_VULKAN(vkEndCommandBuffer(slot.cmd));
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot.cmd;
+    ERR_GUARD_VULKAN(vkQueueSubmit(VulkanContext::getContext().getQueue("compute"), 1, &submitInfo, slot.fence));
+    slot.inFlight = true;
+}
+
+void StreamingUploader::wait(Slot &slot)
+{
+    if (slot.inFlight)
+    {
+        auto device = VulkanContext::getContext().getDevice();
+        auto startTime = std::chrono::high_resolution_clock::now();
+        ERR_GUARD_VULKAN(vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX));
+        ERR_GUARD_VULKAN(vkResetFences(device, 1, &slot.fence));
+        fenceWaitMs += elapsedMs(startTime);
+        slot.inFlight = false;
+    }
+    slot.used = 0;
+    slot.copies.clear();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "buffer.hpp"
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Background thread reading a byte range of a file into a small pool of fixed-size chunks
+class ChunkReader
+{
+public:
+    struct Chunk
+    {
+        const char *data = nullptr;
+        size_t offset = 0; // Relative to the start of the range
+        size_t size = 0;
+    };
+
+    ChunkReader(const std::string &path, size_t begin, size_t size,
+                size_t chunkSize, uint32_t numChunks = 3);
+    ~ChunkReader();
+    ChunkReader(const ChunkReader &) = delete;
+    ChunkReader &operator=(const ChunkReader &) = delete;
+
+    // Next chunk in file order, blocks until it is read; false once the range is exhausted
+    bool next(Chunk &chunk);
+    // Hands a chunk returned by next() back to the reader
+    void release(const Chunk &chunk);
+
+    double getWaitMs() const { return waitMs; }
+
+private:
+    void run();
+
+    std::ifstream file;
+    size_t begin;
+    size_t size;
+    size_t chunkSize;
+    size_t consumed = 0;
+
+    std::vector<std::vector<char>> buffers;
+    std::queue<Chunk> readyChunks;
+    std::queue<char *> freeBuffers;
+    std::mutex mutex;
+    std::condition_variable readyCondition;
+    std::condition_variable freeCondition;
+    std::exception_ptr error;
+    bool stopping = false;
+    double waitMs = 0;
+    std::thread thread;
+};
+
+// Ring of persistently mapped staging slots, each with its own command buffer and fence,
+// so that the CPU fills one slot while the GPU copies the previous ones
+class StreamingUploader
+{
+public:
+    struct Region
+    {
+        Buffer *dst;
+        VkDeviceSize dstOffset;
+        VkDeviceSize size;
+    };
+
+    static constexpr VkDeviceSize defaultSlotSize = 32ull << 20;
+
+    explicit StreamingUploader(VkDeviceSize slotSize = defaultSlotSize, uint32_t numSlots = 3);
+    ~StreamingUploader();
+    StreamingUploader(const StreamingUploader &) = delete;
+    StreamingUploader &operator=(const StreamingUploader &) = delete;
+
+    // Reserves staging memory for all regions in the current slot and queues their copies.
+    // The returned pointers must be filled before the next stage() or flush() call.
+    std::vector<void *> stage(const std::vector<Region> &regions);
+    // Submits the queued copies and waits until every slot is idle
+    void flush();
+
+    VkDeviceSize getSlotSize() const { return slotSize; }
+    VkDeviceSize getBytesUploaded() const { return bytesUploaded; }
+    double getFenceWaitMs() const { return fenceWaitMs; }
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<Buffer> staging;
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkDeviceSize used = 0;
+        bool inFlight = false;
+        std::vector<std::pair<VkBuffer, VkBufferCopy>> copies;
+    };
+
+    void submit(Slot &slot);
+    void wait(Slot &slot);
+
+    VkDeviceSize slotSize;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<Slot> slots;
+    uint32_t currentSlot = 0;
+    VkDeviceSize bytesUploaded = 0;
+    double fenceWaitMs = 0;
+};
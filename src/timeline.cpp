@@ -0,0 +1,43 @@
+#include "timeline.hpp"
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+Timeline::Scope::Scope(Timeline &timeline, std::string name)
+    : timeline(timeline), name(std::move(name)), begin(Clock::now())
+{
+}
+
+Timeline::Scope::~Scope()
+{
+    timeline.record(std::move(name), begin, Clock::now());
+}
+
+void Timeline::record(std::string name, Clock::time_point begin, Clock::time_point end)
+{
+    auto toMs = [this](Clock::time_point t)
+    { return std::chrono::duration<double, std::milli>(t - start).count(); };
+
+    std::lock_guard lock(mutex);
+    phases.push_back({std::move(name), std::this_thread::get_id(), toMs(begin), toMs(end)});
+}
+
+void Timeline::print()
+{
+    std::lock_guard lock(mutex);
+    std::sort(phases.begin(), phases.end(), [](const Phase &a, const Phase &b)
+              { return a.beginMs < b.beginMs; });
+
+    // Number threads in order of first appearance
+    std::vector<std::thread::id> threads;
+    std::cout << "Startup timeline:\n";
+    for (auto &phase : phases)
+    {
+        auto it = std::find(threads.begin(), threads.end(), phase.thread);
+        if (it == threads.end())
+            it = threads.insert(threads.end(), phase.thread);
+
+        std::cout << std::format("  [thread {}] {:>8.1f}ms - {:>8.1f}ms  {}\n",
+                                 it - threads.begin(), phase.beginMs, phase.endMs, phase.name);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Collects named phases from any thread and prints them as one timeline
+class Timeline
+{
+public:
+    using Clock = std::chrono::high_resolution_clock;
+
+    class Scope
+    {
+    public:
+        Scope(Timeline &timeline, std::string name);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Timeline &timeline;
+        std::string name;
+        Clock::time_point begin;
+    };
+
+    Timeline() : start(Clock::now()) {}
+
+    Scope scope(std::string name) { return Scope(*this, std::move(name)); }
+    void print();
+
+private:
+    struct Phase
+    {
+        std::string name;
+        std::thread::id thread;
+        double beginMs;
+        double endMs;
+    };
+
+    void record(std::string name, Clock::time_point begin, Clock::time_point end);
+
+    Clock::time_point start;
+    std::mutex mutex;
+    std::vector<Phase> phases;
+};
@@ -1,5 +1,6 @@
 #include "vulkan_context.h"
 #include "radfoam.hpp"
+#include <cstring>
 
 void VulkanContext::createDebugMessenger()
 {
@@ -67,6 +68,8 @@ void VulkanContext::getPhysicalDevices(uint32_t deviceIndex)
 
     std::vector<VkPhysicalDevice> availablePhysicalDevices(deviceCount);
     ERR_GUARD_VULKAN(vkEnumeratePhysicalDevices(instance, &deviceCount, availablePhysicalDevices.data()));
+    if (deviceIndex >= deviceCount)
+        throw std::runtime_error(std::format("Vulkan device {} requested, {} available", deviceIndex, deviceCount));
     physicalDevice = availablePhysicalDevices[deviceIndex];
 }
 
@@ -110,8 +113,41 @@ void VulkanContext::createLogicalDevice(VkDeviceCreateFlags flags)
     VkPhysicalDeviceFeatures deviceFeatures{};
     vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
 
+    // Lets VMA report the driver's actual budget instead of a share of the heap size
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    for (auto &extension : extensions)
+        if (std::strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+        {
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            memoryBudget = true;
+        }
+
+    // Scene buffers larger than maxStorageBufferRange are bound as several ranges that every ray
+    // picks from on its own. The 1.2 feature struct may only be chained on a 1.2 device.
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+    bool vulkan12 = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_2;
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    if (vulkan12)
+    {
+        VkPhysicalDeviceVulkan12Features supported12{};
+        supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supported{};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supported.pNext = &supported12;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+        features12.shaderStorageBufferArrayNonUniformIndexing = supported12.shaderStorageBufferArrayNonUniformIndexing;
+    }
+    nonUniformStorageIndexing = features12.shaderStorageBufferArrayNonUniformIndexing;
+    // Every resident scene is picked from binding arrays by the uniform's slot
+    dynamicStorageIndexing = deviceFeatures.shaderStorageBufferArrayDynamicIndexing;
+
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = vulkan12 ? &features12 : nullptr;
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
     deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
@@ -134,9 +170,23 @@ void VulkanContext::createVMAAllocator()
     allocatorInfo.physicalDevice = physicalDevice;
     allocatorInfo.device = device;
     allocatorInfo.instance = instance;
+    if (memoryBudget)
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
     vmaCreateAllocator(&allocatorInfo, &allocator);
 }
 
+VkDeviceSize VulkanContext::getAvailableDeviceMemory() const
+{
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(allocator, budgets);
+    VkDeviceSize available = 0;
+    for (uint32_t i = 0; i < physicalDeviceMemoryProperties.memoryHeapCount; ++i)
+        if ((physicalDeviceMemoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+            budgets[i].budget > budgets[i].usage)
+            available += budgets[i].budget - budgets[i].usage;
+    return available;
+}
+
 void VulkanContext::createCommandPool()
 {
     VkCommandPoolCreateInfo poolInfo = {};
@@ -148,14 +198,17 @@ void VulkanContext::createCommandPool()
 
 void VulkanContext::createDescriptorSetPool()
 {
+    // The ray tracing set alone holds about 150 storage buffers with every resident scene slot;
+    // the sets of load-time passes are freed with them, as scenes may be loaded again and again
     std::vector<VkDescriptorPoolSize> poolSizes = {
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 50},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 512},
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10}
     };
 
     VkDescriptorPoolCreateInfo uniformPoolInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
         .maxSets = 100,
         .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
         .pPoolSizes = poolSizes.data()
@@ -322,4 +375,19 @@ void VulkanContext::endSingleTimeCommands(VkCommandBuffer commandBuffer)
     vkQueueSubmit(queue_graphics, 1, &submitInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(queue_graphics); 
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
\ No newline at end of file
+}
+void VulkanContext::markDeviceReady()
+{
+    {
+        std::lock_guard lock(deviceReadyMutex);
+        deviceReady = true;
+    }
+    deviceReadyCondition.notify_all();
+}
+
+void VulkanContext::waitForDevice()
+{
+    std::unique_lock lock(deviceReadyMutex);
+    deviceReadyCondition.wait(lock, [this]
+                              { return deviceReady; });
+}
@@ -7,6 +7,8 @@
 #include <span>
 #include <unordered_set>
 #include <format>
+#include <mutex>
+#include <condition_variable>
 #include "arguments.hpp"
 
 #define GLFW_INCLUDE_VULKAN
@@ -33,8 +35,14 @@ public:
     auto getInstance() const { return this->instance; }
     auto getSurface() const { return this->surface; }
     auto getDevice() const { return this->device; }
+    const auto &getPhysicalDeviceProperties() const { return this->physicalDeviceProperties; }
+    // Descriptor arrays of storage buffers indexed per invocation, see Renderer::bindStream
+    bool supportsNonUniformStorageIndexing() const { return this->nonUniformStorageIndexing; }
+    bool supportsDynamicStorageIndexing() const { return this->dynamicStorageIndexing; }
     // auto getModel() const { return this->pModel; }
     auto getAllocator() const { return this->allocator; }
+    // Budget minus usage over the device-local heaps, from VK_EXT_memory_budget when available
+    VkDeviceSize getAvailableDeviceMemory() const;
     auto getDescriptorPool() const { return this->descriptorPool; }
     auto getCommandPool() const { return this->commandPool; }
     auto getSwapChain() const { return this->swapchain; }
@@ -45,6 +53,8 @@ public:
     auto getMonitor() const { return this->pMonitor; }
     auto getWindowTitle() const { return this->windowTitle; }
 
+    auto getQueueFamilyIndex() const { return this->queueFamilyIndex_graphics; }
+
     VkQueue getQueue(const std::string &type)
     {
         if (type == "compute") return queue_compute;
@@ -80,6 +90,12 @@ public:
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
+    // Startup work running on other threads blocks here until the device and allocator exist
+    void markDeviceReady();
+    void waitForDevice();
+    // Guards allocations from the shared descriptor pool
+    std::mutex &getDescriptorPoolMutex() { return descriptorPoolMutex; }
+
 private:
     std::shared_ptr<RadFoamVulkanArgs> pArgs;
     // std::shared_ptr<RadFoam> pModel;
@@ -97,6 +113,9 @@ private:
     VkPhysicalDevice physicalDevice;
     VkPhysicalDeviceProperties physicalDeviceProperties;
     VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+    bool nonUniformStorageIndexing = false;
+    bool dynamicStorageIndexing = false;
+    bool memoryBudget = false; // VK_EXT_memory_budget enabled
 
     VkCommandPool commandPool;
     VkDescriptorPool descriptorPool;
@@ -120,6 +139,11 @@ private:
     std::vector<void (*)()> callbacksCreateDevice;
     std::vector<void (*)()> callbacksDestroyDevice;
 
+    std::mutex deviceReadyMutex;
+    std::condition_variable deviceReadyCondition;
+    bool deviceReady = false;
+    std::mutex descriptorPoolMutex;
+
     GLFWwindow *pWindow = nullptr;
     GLFWmonitor *pMonitor = nullptr;
     const char *windowTitle = "RadFoam Vulakn Viewer";    
@@ -0,0 +1,224 @@
+#include "../src/arguments.hpp"
+#include "../src/radfoam.hpp"
+#include "../src/scene_pack.hpp"
+#include "../src/parallel.hpp"
+#include "../src/spatial_order.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    using RadFoamCell = RadFoam::RadFoamCell;
+
+    // Cells decoded per batch, a whole number of pack blocks
+    constexpr size_t cellsPerBatch = 32 * ScenePack::cellsPerBlock;
+    constexpr size_t adjacencyPerBatch = 16 << 20;
+
+    // Cells and neighbours in output order: decoded from the PLY batch by batch, or copied from
+    // the whole scene held in memory once it has been reordered
+    class CellSource
+    {
+    public:
+        CellSource(const RadFoamPly &ply, const MappedFile &input) : ply(ply), input(input) {}
+
+        // Decodes the whole scene, sorts it along the curve and writes the permutation next to the output
+        void reorder(SpatialOrder::Curve curve, const std::string &permutationPath)
+        {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            auto &schema = ply.getSchema();
+            if (ply.getNumAdjacency() > UINT32_MAX)
+                throw std::runtime_error(std::format("Reordering renumbers 32-bit adjacency offsets, the scene has {} "
+                                                     "adjacency entries",
+                                                     ply.getNumAdjacency()));
+            positions.resize(ply.getNumVertices());
+            cells.resize(ply.getNumVertices());
+            sh.resize(size_t(ply.getNumVertices()) * ply.getNumShCoeffs());
+            adjacency.resize(ply.getNumAdjacency());
+            ply.convertVertexData(input.data() + ply.getVertexDataOffset(), positions.size(), 0, positions.data(),
+                                  cells.data(), sh.data(), nullptr);
+            for (size_t first = 0; first < adjacency.size(); first += adjacencyPerBatch)
+                ply.convertAdjacencyData(input.data() + ply.getAdjacencyDataOffset() + first * schema.adjacencyStride,
+                                         std::min(adjacencyPerBatch, adjacency.size() - first), adjacency.data() + first);
+
+            auto keys = SpatialOrder::computeKeys(positions.data(), positions.size(), curve);
+            auto order = SpatialOrder::sortKeys(keys);
+            keys = {};
+            SpatialOrder::apply(order, ply.getNumShCoeffs(), positions, cells, sh, adjacency);
+            SpatialOrder::writePermutation(permutationPath, order);
+
+            auto endTime = std::chrono::high_resolution_clock::now();
+            std::cout << std::format("Reordered {} cells in {}ms, permutation written to {}\n", positions.size(),
+                                     std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count(),
+                                     permutationPath);
+        }
+
+        void readCells(size_t first, size_t count, uint32_t adjacencyBegin, glm::vec4 *positionDst,
+                       RadFoamCell *cellDst, float *shDst) const
+        {
+            if (positions.empty())
+            {
+                ply.convertVertexData(input.data() + ply.getVertexDataOffset() + first * ply.getSchema().stride, count,
+                                      adjacencyBegin, positionDst, cellDst, shDst, nullptr);
+                return;
+            }
+            std::copy_n(positions.data() + first, count, positionDst);
+            std::copy_n(cells.data() + first, count, cellDst);
+            std::copy_n(sh.data() + first * ply.getNumShCoeffs(), count * ply.getNumShCoeffs(), shDst);
+        }
+
+        void readAdjacency(size_t first, size_t count, uint32_t *dst) const
+        {
+            if (adjacency.empty())
+                ply.convertAdjacencyData(input.data() + ply.getAdjacencyDataOffset() +
+                                             first * ply.getSchema().adjacencyStride,
+                                         count, dst);
+            else
+                std::copy_n(adjacency.data() + first, count, dst);
+        }
+
+    private:
+        const RadFoamPly &ply;
+        const MappedFile &input;
+        std::vector<glm::vec4> positions;
+        std::vector<RadFoamCell> cells;
+        std::vector<float> sh;
+        std::vector<uint32_t> adjacency;
+    };
+
+    // Viewer-ready PLY: float32 fields and the full SH basis in coefficient-interleaved order.
+    // Adjacency offsets are 64-bit once they exceed 32 bits.
+    void writePly(const RadFoamPly &ply, const CellSource &source, const std::string &path)
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            throw std::runtime_error("Failed to open output file: " + path);
+
+        uint32_t numShCoeffs = ply.getNumShCoeffs();
+        bool wideOffsets = ply.getNumAdjacency() > UINT32_MAX;
+        size_t offsetSize = wideOffsets ? sizeof(uint64_t) : sizeof(uint32_t);
+        std::string header = std::format("ply\nformat binary_little_endian 1.0\nelement vertex {}\n"
+                                          "property float x\nproperty float y\nproperty float z\n"
+                                          "property float density\nproperty {} adjacency_offset\n",
+                                          ply.getNumVertices(), wideOffsets ? "uint64" : "uint");
+        for (uint32_t c = 0; c < numShCoeffs; ++c)
+            header += std::format("property float color_sh_{}\n", c);
+        header += std::format("element adjacency {}\nproperty uint adjacency\nend_header\n", ply.getNumAdjacency());
+        ofs.write(header.data(), header.size());
+
+        size_t recordSize = 4 * sizeof(float) + offsetSize + numShCoeffs * sizeof(float);
+        std::vector<glm::vec4> positions;
+        std::vector<RadFoamCell> cells;
+        std::vector<float> sh;
+        std::vector<char> records;
+        uint64_t adjacencyBegin = 0;
+        for (size_t first = 0; first < ply.getNumVertices(); first += cellsPerBatch)
+        {
+            size_t count = std::min<size_t>(cellsPerBatch, ply.getNumVertices() - first);
+            positions.resize(count);
+            cells.resize(count);
+            sh.resize(count * numShCoeffs);
+            records.resize(count * recordSize);
+            source.readCells(first, count, static_cast<uint32_t>(adjacencyBegin), positions.data(), cells.data(),
+                             sh.data());
+
+            // A batch holds less than 2^32 entries, so every end extends from the batch's begin
+            parallelFor(count, [&](size_t begin, size_t end)
+                        {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    char *record = records.data() + i * recordSize;
+                    uint64_t adjacencyEnd = RadFoam::extendOffset(adjacencyBegin, cells[i].adjacencyEnd);
+                    std::memcpy(record, &positions[i], 3 * sizeof(float));
+                    std::memcpy(record + 3 * sizeof(float), &cells[i].density, sizeof(float));
+                    std::memcpy(record + 4 * sizeof(float), &adjacencyEnd, offsetSize);
+                    std::memcpy(record + 4 * sizeof(float) + offsetSize, sh.data() + i * numShCoeffs,
+                                numShCoeffs * sizeof(float));
+                } });
+            ofs.write(records.data(), records.size());
+            adjacencyBegin = RadFoam::extendOffset(adjacencyBegin, cells.back().adjacencyEnd);
+        }
+
+        std::vector<uint32_t> adjacency;
+        for (size_t first = 0; first < ply.getNumAdjacency(); first += adjacencyPerBatch)
+        {
+            size_t count = std::min<size_t>(adjacencyPerBatch, ply.getNumAdjacency() - first);
+            adjacency.resize(count);
+            source.readAdjacency(first, count, adjacency.data());
+            ofs.write(reinterpret_cast<const char *>(adjacency.data()), count * sizeof(uint32_t));
+        }
+
+        if (!ofs)
+            throw std::runtime_error("Failed to write output file: " + path);
+    }
+
+    void writePack(const RadFoamPly &ply, const CellSource &source, const std::string &path)
+    {
+        ScenePack::Writer writer(path, ply.getShDegree(), ply.getNumVertices(), ply.getNumAdjacency());
+
+        std::vector<glm::vec4> positions;
+        std::vector<RadFoamCell> cells;
+        std::vector<float> sh;
+        std::vector<uint32_t> adjacency;
+        size_t adjacencyBegin = 0;
+        for (size_t first = 0; first < ply.getNumVertices(); first += cellsPerBatch)
+        {
+            size_t count = std::min<size_t>(cellsPerBatch, ply.getNumVertices() - first);
+            positions.resize(count);
+            cells.resize(count);
+            sh.resize(count * ply.getNumShCoeffs());
+            source.readCells(first, count, static_cast<uint32_t>(adjacencyBegin), positions.data(), cells.data(),
+                             sh.data());
+
+            size_t adjacencyEnd = RadFoam::extendOffset(adjacencyBegin, cells.back().adjacencyEnd);
+            if (adjacencyEnd > ply.getNumAdjacency())
+                throw std::runtime_error("PLY: adjacency offsets out of range");
+            adjacency.resize(adjacencyEnd - adjacencyBegin);
+            source.readAdjacency(adjacencyBegin, adjacency.size(), adjacency.data());
+
+            writer.append(positions.data(), cells.data(), sh.data(), adjacency.data(), count);
+            adjacencyBegin = adjacencyEnd;
+        }
+        writer.finish();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    auto args = argparse::parse<RadFoamConvertArgs>(argc, argv);
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    try
+    {
+        RadFoamPly ply(args.inputPath, args.planarSh);
+        MappedFile input(args.inputPath);
+
+        auto extension = std::filesystem::path(args.outputPath).extension();
+        if (!ScenePack::isPackPath(args.outputPath) && extension != ".ply")
+            throw std::runtime_error("Unsupported output format: " + args.outputPath);
+
+        CellSource source(ply, input);
+        if (!args.reorder.empty())
+            source.reorder(SpatialOrder::parseCurve(args.reorder), args.outputPath + ".perm");
+
+        if (ScenePack::isPackPath(args.outputPath))
+            writePack(ply, source, args.outputPath);
+        else
+            writePly(ply, source, args.outputPath);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+        std::cout << std::format("Converted {} cells in {}ms ({:.0f}MB/s), peak RSS {}MB\n",
+                                 ply.getNumVertices(), ms, (input.size() >> 20) * 1000.0 / std::max<long long>(ms, 1),
+                                 getPeakResidentMemory() >> 20);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
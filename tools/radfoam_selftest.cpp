@@ -0,0 +1,201 @@
+#include "../src/radfoam.hpp"
+#include "../src/renderer.hpp"
+#include "../src/ply.hpp"
+#include "../src/platform.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+
+// Host checks of the 64-bit scene counts and adjacency offsets on a synthetic scene of more than
+// 4GB of adjacency and 2^32 entries. Nothing is allocated at that size and no device is needed:
+// the cell records are generated batch by batch, the bindings are laid out from their sizes and
+// the shader's index math is replayed on the host.
+namespace
+{
+    using RadFoamCell = RadFoam::RadFoamCell;
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        std::cout << (condition ? "ok     " : "FAILED ") << what << "\n";
+        failures += !condition;
+    }
+
+    // 2^27 cells of 32 to 47 neighbours: about 5.3 * 10^9 entries, 20GB of adjacency
+    constexpr uint64_t numCells = uint64_t(1) << 27;
+    uint32_t valence(uint64_t cell) { return 32 + (static_cast<uint32_t>(cell * 2654435761u) >> 28); }
+
+    // Counts of a PLY header are read as 64-bit, as are 64-bit offset properties
+    void checkPlyHeader()
+    {
+        uint64_t numAdjacency = (uint64_t(5) << 32) - 7;
+        std::string text = std::format("ply\nformat binary_little_endian 1.0\nelement vertex {}\n"
+                                       "property float x\nproperty float y\nproperty float z\nproperty float density\n"
+                                       "property uint64 adjacency_offset\nproperty float color_sh_0\n"
+                                       "property float color_sh_1\nproperty float color_sh_2\n"
+                                       "element adjacency {}\nproperty uint adjacency\nend_header\n",
+                                       numCells, numAdjacency);
+        auto header = PlyHeader::parse(text.data(), text.size());
+        auto vertex = header.findElement("vertex");
+        auto adjacency = header.findElement("adjacency");
+        check(vertex && vertex->count == numCells && vertex->stride == 36, "PLY: vertex count and 64-bit offset field");
+        check(adjacency && adjacency->count == numAdjacency, "PLY: adjacency count beyond 2^32");
+        check(header.fileSize() == text.size() + numCells * 36 + numAdjacency * 4, "PLY: file size beyond 4GB");
+
+        uint64_t offset = (uint64_t(3) << 32) + 5;
+        check(readPlyValue<uint64_t>(reinterpret_cast<const char *>(&offset), PlyType::UInt64) == offset,
+              "PLY: uint64 values");
+    }
+
+    // The generic decoder keeps the low words of 64-bit offsets, the scan restores the high ones
+    void checkPlyDecode()
+    {
+        auto path = (std::filesystem::temp_directory_path() / "radfoam_selftest.ply").string();
+        const uint64_t ends[] = {(uint64_t(1) << 32) - 3, (uint64_t(1) << 32) - 1, (uint64_t(1) << 32) + 2,
+                                 (uint64_t(1) << 32) + 4};
+        {
+            std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+            ofs << "ply\nformat binary_little_endian 1.0\nelement vertex 4\nproperty float x\nproperty float y\n"
+                   "property float z\nproperty float density\nproperty uint64 adjacency_offset\n"
+                   "property float color_sh_0\nproperty float color_sh_1\nproperty float color_sh_2\n"
+                   "element adjacency 4\nproperty uint adjacency\nend_header\n";
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                float fields[4] = {float(i), 0.0f, 0.0f, 1.0f}, sh[3] = {};
+                ofs.write(reinterpret_cast<const char *>(fields), sizeof(fields));
+                ofs.write(reinterpret_cast<const char *>(&ends[i]), sizeof(uint64_t));
+                ofs.write(reinterpret_cast<const char *>(sh), sizeof(sh));
+            }
+            uint32_t adjacency[4] = {1, 0, 3, 2};
+            ofs.write(reinterpret_cast<const char *>(adjacency), sizeof(adjacency));
+        }
+
+        {
+            RadFoamPly ply(path);
+            MappedFile file(path);
+            glm::vec4 positions[4];
+            RadFoamCell cells[4];
+            float sh[12];
+            uint64_t begin = (uint64_t(1) << 32) - 6;
+            ply.convertVertexData(file.data() + ply.getVertexDataOffset(), 4, static_cast<uint32_t>(begin), positions,
+                                  cells, sh, nullptr);
+            check(cells[0].adjacencyBegin == static_cast<uint32_t>(begin) && cells[3].adjacencyEnd == 4,
+                  "PLY decode: low words of 64-bit offsets");
+
+            std::vector<uint32_t> wraps;
+            uint64_t end = begin;
+            RadFoam::scanAdjacencyWraps(cells, 0, 4, end, wraps);
+            check(wraps == std::vector<uint32_t>{3} && end == ends[3], "PLY decode: wrap at the first cell past 2^32");
+        }
+        std::filesystem::remove(path);
+    }
+
+    // Wraps of the synthetic scene, and the shader's chunk and element of every entry around them
+    void checkScene()
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        constexpr size_t cellsPerBatch = size_t(1) << 20;
+        std::vector<RadFoamCell> cells(cellsPerBatch);
+        std::vector<uint32_t> wraps, expectedWraps;
+        uint64_t end = 0, expectedEnd = 0;
+        bool scanned = true;
+        for (uint64_t first = 0; first < numCells; first += cellsPerBatch)
+        {
+            for (size_t i = 0; i < cellsPerBatch; ++i)
+            {
+                if (expectedEnd >> 32 > expectedWraps.size())
+                    expectedWraps.push_back(static_cast<uint32_t>(first + i));
+                cells[i] = {1.0f, static_cast<uint32_t>(expectedEnd),
+                            static_cast<uint32_t>(expectedEnd + valence(first + i))};
+                expectedEnd += valence(first + i);
+            }
+            try
+            {
+                RadFoam::scanAdjacencyWraps(cells.data(), first, cellsPerBatch, end, wraps);
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << e.what() << "\n";
+                scanned = false;
+                break;
+            }
+        }
+        check(scanned && expectedEnd > UINT32_MAX && end == expectedEnd,
+              std::format("Scene: {} cells, {} adjacency entries ({}GB)", numCells, end, end * 4 >> 30));
+        check(wraps == expectedWraps && wraps.size() == (end - 1) >> 32 && wraps.size() <= RadFoam::maxAdjacencyWraps,
+              std::format("Scene: {} adjacency wraps", wraps.size()));
+
+        // Renderer::bindStream on a device with 4GB bindings
+        VkDeviceSize maxRange = UINT32_MAX;
+        auto adjacency = Renderer::getStreamLayout(end * sizeof(uint32_t), sizeof(uint32_t), maxRange);
+        auto positions = Renderer::getStreamLayout(numCells * sizeof(glm::vec4), sizeof(glm::vec4), maxRange);
+        check(adjacency.chunkShift == 29 && adjacency.numChunks > 8 &&
+                  adjacency.numChunks <= Renderer::maxAdjacencyChunks,
+              std::format("Bindings: adjacency in {} ranges of 2^{} entries", adjacency.numChunks, adjacency.chunkShift));
+        check(positions.numChunks <= Renderer::getMaxChunks(1),
+              std::format("Bindings: positions in {} ranges", positions.numChunks));
+
+        // ray_tracing.comp: get_adjacency_high, the carry of the face loop and ADJACENCY_SLOT
+        uint32_t shift = adjacency.chunkShift;
+        bool indexed = true, delta = true;
+        uint64_t begin = 0;
+        size_t nextWrap = 0;
+        for (uint64_t cell = 0; cell < numCells; ++cell)
+        {
+            uint32_t count = valence(cell);
+            if (nextWrap < wraps.size() && cell + 4 >= wraps[nextWrap])
+            {
+                uint32_t high = 0;
+                for (uint32_t wrap : wraps)
+                    high += cell >= wrap;
+                uint32_t low = static_cast<uint32_t>(begin);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    uint32_t a = low + i;
+                    uint32_t carry = a < low;
+                    uint64_t chunk = (uint64_t(high + carry) << (32 - shift)) | (a >> shift);
+                    uint64_t element = a & ((uint32_t(1) << shift) - 1);
+                    indexed = indexed && (chunk << shift) + element == begin + i && chunk < adjacency.numChunks;
+                    uint32_t halfHigh = (high + carry) >> 1, halfLow = ((high + carry) << 31) | (a >> 1);
+                    delta = delta && ((uint64_t(halfHigh) << 32) | halfLow) == (begin + i) >> 1;
+                }
+                if (cell == wraps[nextWrap] + 4)
+                    ++nextWrap;
+            }
+            begin += count;
+        }
+        check(indexed, "Shader: chunk and element of the entries around every wrap");
+        check(delta, "Shader: 16-bit entry words around every wrap");
+
+        // Pack blocks and pages take the 64-bit end of their last cell from its low word
+        uint64_t blockBegin = (uint64_t(1) << 32) - 100;
+        check(RadFoam::extendOffset(blockBegin, 50) == (uint64_t(1) << 32) + 50 &&
+                  RadFoam::extendOffset(blockBegin, static_cast<uint32_t>(blockBegin)) == blockBegin,
+              "Offsets: low words extend across 2^32");
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout << std::format("Synthetic scene checked in {}ms\n",
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count());
+    }
+}
+
+int main()
+{
+    try
+    {
+        checkPlyHeader();
+        checkPlyDecode();
+        checkScene();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << (failures ? std::format("{} checks failed\n", failures) : "All checks passed\n");
+    return failures ? 1 : 0;
+}
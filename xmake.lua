@@ -1,16 +1,10 @@
 add_rules("mode.debug", "mode.release")
 
-target("radfoam-vulkan-viewer")
+-- Toolchain paths and libraries shared by every target that links src/
+local function add_radfoam_deps()
     set_languages("c++20")
-    set_kind("binary")
     set_rundir("$(projectdir)")
 
-    before_build(function (target)
-        if os.exec("scripts\\compile_shaders.bat") then
-            raise("Error compiling shaders")
-        end
-    end)
-
     add_includedirs("./lib")
 
     add_includedirs("C:/Users/Lozical/scoop/apps/glfw/current/include")
@@ -21,8 +15,33 @@ target("radfoam-vulkan-viewer")
     add_linkdirs("C:/VulkanSDK/1.3.296.0/Lib") 
     add_links("vulkan-1")
     
-    add_syslinks("gdi32", "user32", "shell32")
+    add_syslinks("gdi32", "user32", "shell32", "psapi")
+
+    add_files("src/*.cpp")
+end
+
+target("radfoam-vulkan-viewer")
+    set_kind("binary")
+    add_radfoam_deps()
+
+    before_build(function (target)
+        if os.exec("scripts\\compile_shaders.bat") then
+            raise("Error compiling shaders")
+        end
+    end)
 
-    
     add_files("main.cpp")
-    add_files("src/*.cpp")
\ No newline at end of file
+
+-- Multithreaded PLY fix-up and .rfpack export, replaces convert.py for existing PLYs
+target("radfoam-convert")
+    set_kind("binary")
+    add_radfoam_deps()
+
+    add_files("tools/radfoam_convert.cpp")
+
+-- Host checks of 64-bit scene counts and adjacency offsets on a synthetic scene, no GPU needed
+target("radfoam-selftest")
+    set_kind("binary")
+    add_radfoam_deps()
+
+    add_files("tools/radfoam_selftest.cpp")